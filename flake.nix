@@ -23,6 +23,8 @@
             pkg-config
 
             systemdLibs
+            freetype
+            libxkbcommon
             wayland
             wayland-protocols
             wayland-scanner
@@ -42,6 +44,8 @@
                 ]
                 ++ buildInputs;
               LD_LIBRARY_PATH = "${lib.makeLibraryPath buildInputs}";
+              # Font of sinit benchmark text scenarios.
+              SINIT_BENCH_FONT = "${pkgs.dejavu_fonts}/share/fonts/truetype/DejaVuSans.ttf";
               DEBUG = 1;
             };
           };
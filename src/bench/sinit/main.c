@@ -0,0 +1,526 @@
+/**
+ * sinit benchmark drives sinit surfaces against an in-process stand-in
+ * compositor and reports frame times, allocations and buffer throughput of
+ * a few scenarios (steady frames, full repaints, resize storms, scale changes,
+ * tiled full-screen layer surfaces, a changing text label and the same label
+ * in a retained scene).
+ *
+ * Text scenarios need a font, passed with --font or SINIT_BENCH_FONT, and are
+ * skipped otherwise.
+ *
+ * Compositor presents every commit right away and fires frame callbacks on
+ * commit, so frame times measure sinit and the render function only.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_IMPLEMENTATION
+#define LOG_MODULE "main"
+#include "log.h"
+
+#include "macros.h"
+#include "sinit.h"
+#include "sinit_draw.h"
+#include "sinit_scene.h"
+#include "sinit_text.h"
+
+#include "server.h"
+
+#define NSEC_PER_SEC 1000000000ull
+
+// Time a frame may take before benchmark is aborted.
+#define STALL_TIMEOUT_MS 5000
+
+#define SQUARE_SIZE 64
+
+// Font size and position of label, in surface-local pixels.
+#define LABEL_SIZE 24
+#define LABEL_MARGIN 16
+
+/* Allocation tracking */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+// Only allocations of the thread driving sinit are counted, stand-in
+// compositor runs on its own thread.
+static _Thread_local bool track_allocations = false;
+static uint64_t allocations = 0;
+
+void *malloc(size_t size) {
+  if (track_allocations)
+    allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  if (track_allocations)
+    allocations++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (track_allocations)
+    allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+/* Scenarios */
+
+struct bench {
+  sinit_surface surf;
+  int iterations;
+
+  // Geometry of last rendered frame.
+  int width;
+  int height;
+  double scale;
+
+  // Geometry the current iteration waits for, width is 0 if any geometry
+  // will do.
+  int target_width;
+  int target_height;
+  double target_scale;
+
+  // Moving square of partial frames.
+  bool partial;
+  int square_x;
+  int iteration;
+
+  // Scene of scene scenarios and its label.
+  bool has_scene;
+  struct sinit_scene scene;
+  struct sinit_node *label;
+
+  // Duration of each iteration.
+  uint64_t *samples;
+};
+
+struct scenario {
+  const char *name;
+  void (*init)(struct bench *b);
+  void (*step)(struct bench *b, int i);
+  // Scenario draws text and needs a font.
+  bool text;
+};
+
+// Font of text scenarios, NULL if none was provided.
+static struct sinit_font *font = NULL;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint32_t bench_color(int i) {
+  return sinit_draw_color(0xff, i * 7, i * 13, i * 29);
+}
+
+static void render(sinit_surface *surf, void *buf, int width, int height,
+                   int stride, enum sinit_format format, double scale,
+                   uint32_t time, void *userdata) {
+  (void)format;
+  (void)time;
+
+  struct bench *b = userdata;
+  int bw = sinit_scale_length(width, scale);
+  int bh = sinit_scale_length(height, scale);
+
+  b->width = width;
+  b->height = height;
+  b->scale = scale;
+
+  if (!b->partial || !sinit_surface_buffer_valid(surf) || bw < SQUARE_SIZE ||
+      bh < SQUARE_SIZE) {
+    sinit_draw_rect(buf, stride, 0, 0, bw, bh, bench_color(b->iteration));
+    return;
+  }
+
+  // Move square.
+  sinit_draw_rect(buf, stride, b->square_x, 0, SQUARE_SIZE, SQUARE_SIZE,
+                  bench_color(0));
+  sinit_surface_damage(surf, b->square_x, 0, SQUARE_SIZE, SQUARE_SIZE);
+  b->square_x = (b->square_x + 8) % (bw - SQUARE_SIZE);
+  sinit_draw_rect(buf, stride, b->square_x, 0, SQUARE_SIZE, SQUARE_SIZE,
+                  bench_color(b->iteration));
+  sinit_surface_damage(surf, b->square_x, 0, SQUARE_SIZE, SQUARE_SIZE);
+}
+
+static void render_tile(sinit_surface *surf, void *buf, int stride,
+                        enum sinit_format format, struct sinit_rect tile,
+                        double scale, uint32_t time, void *userdata) {
+  (void)surf;
+  (void)format;
+  (void)scale;
+  (void)time;
+
+  struct bench *b = userdata;
+  sinit_draw_rect(buf, stride, 0, 0, tile.width, tile.height,
+                  bench_color(b->iteration + tile.x + tile.y));
+}
+
+// Repaints a battery-like percentage label, only the label is damaged once
+// buffer is valid.
+static void render_label(sinit_surface *surf, void *buf, int width, int height,
+                         int stride, enum sinit_format format, double scale,
+                         uint32_t time, void *userdata) {
+  (void)format;
+  (void)time;
+
+  struct bench *b = userdata;
+  int bw = sinit_scale_length(width, scale);
+  int bh = sinit_scale_length(height, scale);
+
+  b->width = width;
+  b->height = height;
+  b->scale = scale;
+
+  if (!sinit_surface_buffer_valid(surf))
+    sinit_draw_rect(buf, stride, 0, 0, bw, bh, bench_color(0));
+
+  // Clear area of the widest label.
+  struct sinit_text_extents extents;
+  sinit_text_extents(font, scale, "100%", &extents);
+  int x = sinit_scale_length(LABEL_MARGIN, scale);
+  int y = sinit_scale_length(LABEL_MARGIN, scale);
+  int w = extents.width;
+  int h = extents.ascent + extents.descent;
+  if (x + w > bw || y + h > bh)
+    return;
+  sinit_draw_rect(buf, stride, x, y, w, h, bench_color(0));
+
+  char label[8];
+  snprintf(label, sizeof(label), "%d%%", 100 - b->iteration % 101);
+  sinit_text_draw(buf, stride, bw, bh, font, scale, x, y + extents.ascent,
+                  label, sinit_draw_color(0xff, 0xff, 0xff, 0xff));
+  sinit_surface_damage(surf, x, y, w, h);
+}
+
+static void init_xdg(struct bench *b) {
+  sinit_xdg_surface_init(&b->surf, 1920, 1080, true, render, b);
+}
+
+static void init_xdg_partial(struct bench *b) {
+  b->partial = true;
+  init_xdg(b);
+}
+
+static void init_layer_tiled(struct bench *b) {
+  sinit_layer_surface_init(&b->surf, NULL, SINIT_LAYER_BACKGROUND,
+                           SINIT_ANCHOR_TOP | SINIT_ANCHOR_BOTTOM |
+                               SINIT_ANCHOR_LEFT | SINIT_ANCHOR_RIGHT,
+                           0, 0, 0, true, NULL, b);
+  sinit_surface_tiled(&b->surf, render_tile, 0);
+}
+
+static void init_label(struct bench *b) {
+  sinit_xdg_surface_init(&b->surf, 1920, 1080, true, render_label, b);
+}
+
+// A status-bar-like scene: a row of colored blocks followed by a label.
+static void init_scene(struct bench *b) {
+  b->has_scene = true;
+  sinit_scene_init(&b->scene, &b->surf, bench_color(0));
+  sinit_xdg_surface_init(&b->surf, 1920, 1080, true, sinit_scene_render,
+                         &b->scene);
+
+  struct sinit_node *row =
+      sinit_node_group(sinit_scene_root(&b->scene), SINIT_LAYOUT_ROW);
+  sinit_node_set_position(row, LABEL_MARGIN, LABEL_MARGIN);
+  sinit_node_set_spacing(row, 8, 4);
+  sinit_node_set_color(row, bench_color(1));
+  for (int i = 0; i < 8; i++) {
+    struct sinit_node *block = sinit_node_rect(row, bench_color(i + 2));
+    sinit_node_set_size(block, LABEL_SIZE, LABEL_SIZE);
+  }
+  b->label = sinit_node_text(row, font, "100%",
+                             sinit_draw_color(0xff, 0xff, 0xff, 0xff));
+}
+
+// Updates scene label, the scene requests the frame.
+static void step_scene(struct bench *b, int i) {
+  char label[8];
+  snprintf(label, sizeof(label), "%d%%", 100 - (i + 1) % 101);
+  sinit_node_set_text(b->label, label);
+}
+
+static void step_frame(struct bench *b, int i) {
+  (void)i;
+  sinit_surface_request_frame(&b->surf);
+}
+
+static void step_resize(struct bench *b, int i) {
+  b->target_width = 640 + (i * 97) % 1280;
+  b->target_height = 480 + (i * 61) % 600;
+  b->target_scale = b->scale;
+  server_configure(b->target_width, b->target_height);
+}
+
+static void step_scale(struct bench *b, int i) {
+  static const uint32_t scales[] = {120, 150, 180, 240, 90};
+  uint32_t scale = scales[i % ALEN(scales)];
+
+  // Make sure scale changes on every iteration.
+  if (scale == b->scale * SINIT_SCALE_DENOMINATOR)
+    scale = scales[(i + 1) % ALEN(scales)];
+
+  b->target_width = b->width;
+  b->target_height = b->height;
+  b->target_scale = (double)scale / SINIT_SCALE_DENOMINATOR;
+  server_scale(scale);
+}
+
+static void step_tile(struct bench *b, int i) {
+  // Invalidate a moving 512x512 area.
+  sinit_surface_invalidate(&b->surf, (i * 128) % SERVER_OUTPUT_WIDTH,
+                           (i * 64) % SERVER_OUTPUT_HEIGHT, 512, 512);
+  sinit_surface_request_frame(&b->surf);
+}
+
+static const struct scenario scenarios[] = {
+    {"frames", init_xdg_partial, step_frame, false},
+    {"repaint", init_xdg, step_frame, false},
+    {"resize", init_xdg, step_resize, false},
+    {"scale", init_xdg, step_scale, false},
+    {"tiled", init_layer_tiled, step_tile, false},
+    {"label", init_label, step_frame, true},
+    {"scene", init_scene, step_scene, true},
+};
+
+/* Benchmark loop */
+
+// Dispatches events until a frame matching target geometry is presented.
+static void wait_frame(struct bench *b, uint64_t presented) {
+  struct sinit_frame_stats stats;
+
+  for (;;) {
+    sinit_surface_frame_stats(&b->surf, &stats);
+    if (stats.presented > presented &&
+        (b->target_width == 0 ||
+         (b->width == b->target_width && b->height == b->target_height &&
+          b->scale == b->target_scale)))
+      return;
+
+    if (sinit_prepare() < 0)
+      LOG_FATAL("failed to prepare reading events: %m");
+
+    struct pollfd pfd = {.fd = sinit_fd(), .events = POLLIN};
+    int r = poll(&pfd, 1, STALL_TIMEOUT_MS);
+    if (r < 0 && errno != EINTR)
+      LOG_FATAL("failed to poll events: %m");
+    if (r == 0)
+      LOG_FATAL("no frame presented for %d ms", STALL_TIMEOUT_MS);
+
+    if (sinit_dispatch_pending() < 0)
+      LOG_FATAL("failed to dispatch events: %m");
+  }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void run_scenario(const struct scenario *s, int iterations) {
+  if (s->text && font == NULL) {
+    printf("%-8s skipped, no font\n", s->name);
+    return;
+  }
+
+  struct bench b = {.iterations = iterations};
+  b.samples = calloc(iterations, sizeof(*b.samples));
+  if (b.samples == NULL)
+    LOG_FATAL("failed to allocate samples: %m");
+
+  // First frame.
+  s->init(&b);
+  wait_frame(&b, 0);
+
+  struct server_stats before = {0};
+  before.commits = atomic_load(&server_stats.commits);
+  before.pools = atomic_load(&server_stats.pools);
+  before.buffers = atomic_load(&server_stats.buffers);
+  before.attached_bytes = atomic_load(&server_stats.attached_bytes);
+  before.damaged_bytes = atomic_load(&server_stats.damaged_bytes);
+
+  struct sinit_frame_stats stats;
+  uint64_t allocations_before = allocations;
+  uint64_t start = now_ns();
+
+  for (int i = 0; i < iterations; i++) {
+    sinit_surface_frame_stats(&b.surf, &stats);
+    uint64_t t = now_ns();
+
+    b.iteration = i + 1;
+    s->step(&b, i);
+    wait_frame(&b, stats.presented);
+
+    b.samples[i] = now_ns() - t;
+  }
+
+  uint64_t elapsed = now_ns() - start;
+  uint64_t n_allocations = allocations - allocations_before;
+  sinit_surface_frame_stats(&b.surf, &stats);
+
+  qsort(b.samples, iterations, sizeof(*b.samples), cmp_u64);
+  double seconds = (double)elapsed / NSEC_PER_SEC;
+  double mib = 1024.0 * 1024.0;
+
+  printf("%-8s %8d %9.1f %8.3f %8.3f %9.3f %9.2f %9.1f %9.1f %6lu %8lu\n",
+         s->name, iterations, iterations / seconds,
+         b.samples[iterations / 2] / 1e6,
+         b.samples[iterations * 99 / 100] / 1e6, stats.render / 1e6,
+         (double)n_allocations / iterations,
+         (atomic_load(&server_stats.damaged_bytes) - before.damaged_bytes) /
+             mib / seconds,
+         (atomic_load(&server_stats.attached_bytes) - before.attached_bytes) /
+             mib / seconds,
+         (unsigned long)(atomic_load(&server_stats.pools) - before.pools),
+         (unsigned long)(atomic_load(&server_stats.buffers) - before.buffers));
+  fflush(stdout);
+
+  if (b.surf.base.type == SINIT_XDG_TOP_LEVEL_SURFACE)
+    sinit_xdg_toplevel_surface_deinit(&b.surf);
+  else
+    sinit_layer_surface_deinit(&b.surf);
+  if (b.has_scene)
+    sinit_scene_deinit(&b.scene);
+  free(b.samples);
+}
+
+static void print_usage(const char *prog_name) {
+  printf("%s [--iterations N] [--render-threads N] [--tile-threads N] "
+         "[--font PATH] [--log-level LEVEL] [SCENARIO...]\n",
+         prog_name);
+  printf("\nScenarios:");
+  for (size_t i = 0; i < ALEN(scenarios); i++)
+    printf(" %s", scenarios[i].name);
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  // Parse args.
+  char *prog_name = argv[0];
+  enum log_class log_level = LOG_CLASS_WARNING;
+  int iterations = 1000;
+  int render_threads = 0;
+  int tile_threads = 0;
+  const char *font_path = getenv("SINIT_BENCH_FONT");
+  while (1) {
+    static struct option long_options[] = {
+        {"font", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"iterations", required_argument, 0, 'n'},
+        {"log-level", required_argument, 0, 'l'},
+        {"render-threads", required_argument, 0, 'r'},
+        {"tile-threads", required_argument, 0, 't'},
+        {0, 0, 0, 0},
+    };
+
+    int c = getopt_long(argc, argv, "f:hn:l:r:t:", long_options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'f':
+      font_path = optarg;
+      break;
+
+    case 'h':
+      print_usage(prog_name);
+      return EXIT_SUCCESS;
+
+    case 'n':
+      iterations = atoi(optarg);
+      if (iterations <= 0) {
+        fprintf(stderr, "invalid number of iterations\n");
+        print_usage(prog_name);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'l':
+      log_level = log_level_from_string(optarg);
+      if ((int)log_level == -1) {
+        fprintf(stderr, "invalid log level\n");
+        print_usage(prog_name);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'r':
+      render_threads = atoi(optarg);
+      break;
+
+    case 't':
+      tile_threads = atoi(optarg);
+      break;
+
+    case '?':
+      print_usage(prog_name);
+      return EXIT_FAILURE;
+
+    default:
+      BUG("unhandled option -%c", c);
+    }
+  }
+
+  // Setup log.
+  log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, log_level);
+
+  if (font_path != NULL && font_path[0] != '\0') {
+    font = sinit_font_open(font_path, LABEL_SIZE);
+    if (font == NULL)
+      return EXIT_FAILURE;
+  }
+
+  // Connect sinit to stand-in compositor.
+  char fd[16];
+  snprintf(fd, sizeof(fd), "%d", server_start());
+  setenv("WAYLAND_SOCKET", fd, 1);
+
+  track_allocations = true;
+  sinit_init("bench-sinit");
+  sinit_set_render_threads(render_threads);
+  sinit_set_tile_threads(tile_threads);
+
+  printf("pixel kernels: %s, render threads: %d, tile threads: %d\n\n",
+         sinit_draw_backend(), render_threads, tile_threads);
+  printf("%-8s %8s %9s %8s %8s %9s %9s %9s %9s %6s %8s\n", "scenario",
+         "frames", "fps", "p50 ms", "p99 ms", "render ms", "allocs/f",
+         "dmg MiB/s", "att MiB/s", "pools", "buffers");
+
+  for (size_t i = 0; i < ALEN(scenarios); i++) {
+    bool selected = optind == argc;
+    for (int j = optind; j < argc; j++)
+      if (strcmp(argv[j], scenarios[i].name) == 0)
+        selected = true;
+
+    if (selected)
+      run_scenario(&scenarios[i], iterations);
+  }
+
+  sinit_deinit();
+  track_allocations = false;
+  if (font != NULL)
+    sinit_font_close(font);
+  server_stop();
+  log_deinit();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,865 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#define LOG_MODULE "server"
+#include "log.h"
+#include "macros.h"
+
+#include "stable/presentation-time/presentation-time-server.h"
+#include "stable/viewporter/viewporter-server.h"
+#include "stable/xdg-shell/xdg-shell-server.h"
+#include "staging/fractional-scale/fractional-scale-v1-server.h"
+#include "wlr/unstable/wlr-layer-shell-unstable-v1-server.h"
+
+#include "server.h"
+
+#define NSEC_PER_SEC 1000000000ull
+
+/**
+ * Server implements just enough of each protocol for sinit: every commit is
+ * presented right away, frame callbacks are fired on commit and previous
+ * buffer is released as soon as a new one is committed.
+ */
+
+enum server_command_type {
+  SERVER_CONFIGURE,
+  SERVER_SCALE,
+  SERVER_STOP,
+};
+
+struct server_command {
+  enum server_command_type type;
+  int width;
+  int height;
+  uint32_t scale;
+};
+
+enum surface_role {
+  SURFACE_ROLE_NONE,
+  SURFACE_ROLE_TOPLEVEL,
+  SURFACE_ROLE_LAYER,
+};
+
+struct surface {
+  struct wl_resource *resource;
+  struct wl_list link;
+
+  enum surface_role role;
+  // xdg_surface or zwlr_layer_surface_v1.
+  struct wl_resource *role_resource;
+  struct wl_resource *toplevel;
+  struct wl_resource *fractional_scale;
+  bool configured;
+  // Size requested by layer surface.
+  int width;
+  int height;
+
+  // Pending state.
+  struct wl_resource *pending_buffer;
+  struct wl_listener pending_buffer_destroy;
+  bool attached;
+  uint64_t damaged_bytes;
+  struct wl_list frames;
+  struct wl_list feedbacks;
+
+  // Current state.
+  struct wl_resource *buffer;
+  struct wl_listener buffer_destroy;
+};
+
+struct server {
+  struct wl_display *display;
+  struct wl_client *client;
+  struct wl_listener resource_created;
+  pthread_t thread;
+  int command_fds[2];
+
+  struct wl_list surfaces;
+  struct wl_list outputs;
+};
+
+struct server_stats server_stats = {0};
+
+static struct server server = {0};
+
+/* Helpers */
+
+static struct wl_resource *
+resource_create(struct wl_client *client, const struct wl_interface *interface,
+                uint32_t version, uint32_t id, const void *implementation,
+                void *data, wl_resource_destroy_func_t destroy) {
+  struct wl_resource *resource =
+      wl_resource_create(client, interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return NULL;
+  }
+  wl_resource_set_implementation(resource, implementation, data, destroy);
+  return resource;
+}
+
+static void resource_destroy(struct wl_client *client,
+                             struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+// Destroy function of resources linked in a list.
+static void resource_unlink(struct wl_resource *resource) {
+  wl_list_remove(wl_resource_get_link(resource));
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* wl_region */
+
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+                       int32_t x, int32_t y, int32_t width, int32_t height) {
+  (void)client;
+  (void)resource;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+}
+
+static const struct wl_region_interface region_impl = {
+    .destroy = resource_destroy,
+    .add = region_add,
+    .subtract = region_add,
+};
+
+/* wl_surface */
+
+static void surface_configure(struct surface *surf, int width, int height) {
+  uint32_t serial = wl_display_next_serial(server.display);
+
+  switch (surf->role) {
+  case SURFACE_ROLE_TOPLEVEL: {
+    struct wl_array states;
+    wl_array_init(&states);
+    xdg_toplevel_send_configure(surf->toplevel, width, height, &states);
+    wl_array_release(&states);
+    xdg_surface_send_configure(surf->role_resource, serial);
+    break;
+  }
+
+  case SURFACE_ROLE_LAYER:
+    zwlr_layer_surface_v1_send_configure(surf->role_resource, serial, width,
+                                         height);
+    break;
+
+  case SURFACE_ROLE_NONE:
+    return;
+  }
+
+  atomic_fetch_add(&server_stats.configures, 1);
+}
+
+static void surface_set_scale(struct surface *surf, uint32_t scale) {
+  if (surf->fractional_scale != NULL)
+    wp_fractional_scale_v1_send_preferred_scale(surf->fractional_scale, scale);
+  else if (wl_resource_get_version(surf->resource) >= 6)
+    wl_surface_send_preferred_buffer_scale(surf->resource, (scale + 119) / 120);
+}
+
+static void surface_pending_buffer_destroy(struct wl_listener *listener,
+                                           void *data) {
+  (void)data;
+  struct surface *surf =
+      wl_container_of(listener, surf, pending_buffer_destroy);
+  surf->pending_buffer = NULL;
+}
+
+static void surface_buffer_destroy(struct wl_listener *listener, void *data) {
+  (void)data;
+  struct surface *surf = wl_container_of(listener, surf, buffer_destroy);
+  surf->buffer = NULL;
+}
+
+// Replaces buffer referenced by slot and moves listener to the new buffer.
+static void surface_track_buffer(struct wl_resource **slot,
+                                 struct wl_listener *listener,
+                                 struct wl_resource *buffer) {
+  if (*slot != NULL)
+    wl_list_remove(&listener->link);
+  *slot = buffer;
+  if (buffer != NULL)
+    wl_resource_add_destroy_listener(buffer, listener);
+}
+
+static void surface_attach(struct wl_client *client,
+                           struct wl_resource *resource,
+                           struct wl_resource *buffer, int32_t x, int32_t y) {
+  (void)client;
+  (void)x;
+  (void)y;
+
+  struct surface *surf = wl_resource_get_user_data(resource);
+  surface_track_buffer(&surf->pending_buffer, &surf->pending_buffer_destroy,
+                       buffer);
+  surf->attached = true;
+}
+
+static void surface_damage(struct wl_client *client,
+                           struct wl_resource *resource, int32_t x, int32_t y,
+                           int32_t width, int32_t height) {
+  (void)client;
+  (void)x;
+  (void)y;
+
+  struct surface *surf = wl_resource_get_user_data(resource);
+  if (width > 0 && height > 0)
+    surf->damaged_bytes += (uint64_t)width * height * 4;
+}
+
+static void surface_frame(struct wl_client *client,
+                          struct wl_resource *resource, uint32_t id) {
+  struct surface *surf = wl_resource_get_user_data(resource);
+  struct wl_resource *callback = resource_create(
+      client, &wl_callback_interface, 1, id, NULL, NULL, resource_unlink);
+  if (callback != NULL)
+    wl_list_insert(surf->frames.prev, wl_resource_get_link(callback));
+}
+
+static void surface_set_region(struct wl_client *client,
+                               struct wl_resource *resource,
+                               struct wl_resource *region) {
+  (void)client;
+  (void)resource;
+  (void)region;
+}
+
+static void surface_commit(struct wl_client *client,
+                           struct wl_resource *resource) {
+  (void)client;
+
+  struct surface *surf = wl_resource_get_user_data(resource);
+  uint64_t now = now_ns();
+
+  if (surf->attached) {
+    if (surf->buffer != NULL && surf->buffer != surf->pending_buffer)
+      wl_buffer_send_release(surf->buffer);
+
+    surface_track_buffer(&surf->buffer, &surf->buffer_destroy,
+                         surf->pending_buffer);
+    surface_track_buffer(&surf->pending_buffer, &surf->pending_buffer_destroy,
+                         NULL);
+    surf->attached = false;
+
+    struct wl_shm_buffer *shm =
+        surf->buffer != NULL ? wl_shm_buffer_get(surf->buffer) : NULL;
+    if (shm != NULL)
+      atomic_fetch_add(&server_stats.attached_bytes,
+                       (uint64_t)wl_shm_buffer_get_stride(shm) *
+                           wl_shm_buffer_get_height(shm));
+  }
+
+  atomic_fetch_add(&server_stats.damaged_bytes, surf->damaged_bytes);
+  atomic_fetch_add(&server_stats.commits, 1);
+  surf->damaged_bytes = 0;
+
+  struct wl_resource *r, *tmp;
+  wl_resource_for_each_safe(r, tmp, &surf->frames) {
+    wl_callback_send_done(r, now / 1000000);
+    wl_resource_destroy(r);
+  }
+
+  wl_resource_for_each_safe(r, tmp, &surf->feedbacks) {
+    uint64_t sec = now / NSEC_PER_SEC;
+    // Unknown refresh rate so sinit renders as soon as possible.
+    wp_presentation_feedback_send_presented(r, sec >> 32, sec & 0xffffffff,
+                                            now % NSEC_PER_SEC, 0, 0, 0, 0);
+    wl_resource_destroy(r);
+  }
+
+  if (surf->role != SURFACE_ROLE_NONE && !surf->configured) {
+    surf->configured = true;
+
+    wl_resource_for_each(r, &server.outputs) {
+      if (wl_resource_get_client(r) == wl_resource_get_client(resource))
+        wl_surface_send_enter(resource, r);
+    }
+
+    if (surf->role == SURFACE_ROLE_LAYER)
+      surface_configure(surf,
+                        surf->width > 0 ? surf->width : SERVER_OUTPUT_WIDTH,
+                        surf->height > 0 ? surf->height
+                                         : SERVER_OUTPUT_HEIGHT);
+    else
+      surface_configure(surf, 0, 0);
+  }
+}
+
+static void surface_set_int(struct wl_client *client,
+                            struct wl_resource *resource, int32_t value) {
+  (void)client;
+  (void)resource;
+  (void)value;
+}
+
+static void surface_offset(struct wl_client *client,
+                           struct wl_resource *resource, int32_t x,
+                           int32_t y) {
+  (void)client;
+  (void)resource;
+  (void)x;
+  (void)y;
+}
+
+static const struct wl_surface_interface surface_impl = {
+    .destroy = resource_destroy,
+    .attach = surface_attach,
+    .damage = surface_damage,
+    .frame = surface_frame,
+    .set_opaque_region = surface_set_region,
+    .set_input_region = surface_set_region,
+    .commit = surface_commit,
+    .set_buffer_transform = surface_set_int,
+    .set_buffer_scale = surface_set_int,
+    .damage_buffer = surface_damage,
+    .offset = surface_offset,
+};
+
+static void surface_resource_destroy(struct wl_resource *resource) {
+  struct surface *surf = wl_resource_get_user_data(resource);
+
+  struct wl_resource *r, *tmp;
+  wl_resource_for_each_safe(r, tmp, &surf->frames) wl_resource_destroy(r);
+  wl_resource_for_each_safe(r, tmp, &surf->feedbacks) wl_resource_destroy(r);
+
+  // Objects extending surface may outlive it.
+  if (surf->role_resource != NULL)
+    wl_resource_set_user_data(surf->role_resource, NULL);
+  if (surf->toplevel != NULL)
+    wl_resource_set_user_data(surf->toplevel, NULL);
+  if (surf->fractional_scale != NULL)
+    wl_resource_set_user_data(surf->fractional_scale, NULL);
+
+  surface_track_buffer(&surf->pending_buffer, &surf->pending_buffer_destroy,
+                       NULL);
+  surface_track_buffer(&surf->buffer, &surf->buffer_destroy, NULL);
+  wl_list_remove(&surf->link);
+  free(surf);
+}
+
+/* wl_compositor */
+
+static void compositor_create_surface(struct wl_client *client,
+                                      struct wl_resource *resource,
+                                      uint32_t id) {
+  struct surface *surf = calloc(1, sizeof(*surf));
+  if (surf == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  surf->resource =
+      resource_create(client, &wl_surface_interface,
+                      wl_resource_get_version(resource), id, &surface_impl,
+                      surf, surface_resource_destroy);
+  if (surf->resource == NULL) {
+    free(surf);
+    return;
+  }
+
+  surf->pending_buffer_destroy.notify = surface_pending_buffer_destroy;
+  surf->buffer_destroy.notify = surface_buffer_destroy;
+  wl_list_init(&surf->frames);
+  wl_list_init(&surf->feedbacks);
+  wl_list_insert(&server.surfaces, &surf->link);
+}
+
+static void compositor_create_region(struct wl_client *client,
+                                     struct wl_resource *resource,
+                                     uint32_t id) {
+  (void)resource;
+  resource_create(client, &wl_region_interface, 1, id, &region_impl, NULL,
+                  NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+    .create_surface = compositor_create_surface,
+    .create_region = compositor_create_region,
+};
+
+static void bind_compositor(struct wl_client *client, void *data,
+                            uint32_t version, uint32_t id) {
+  resource_create(client, &wl_compositor_interface, version, id,
+                  &compositor_impl, data, NULL);
+}
+
+/* wl_output */
+
+static const struct wl_output_interface output_impl = {
+    .release = resource_destroy,
+};
+
+static void bind_output(struct wl_client *client, void *data,
+                        uint32_t version, uint32_t id) {
+  struct wl_resource *resource =
+      resource_create(client, &wl_output_interface, version, id, &output_impl,
+                      data, resource_unlink);
+  if (resource == NULL)
+    return;
+  wl_list_insert(&server.outputs, wl_resource_get_link(resource));
+
+  wl_output_send_geometry(resource, 0, 0, 600, 340,
+                          WL_OUTPUT_SUBPIXEL_UNKNOWN, "desk", "bench",
+                          WL_OUTPUT_TRANSFORM_NORMAL);
+  wl_output_send_mode(resource,
+                      WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+                      SERVER_OUTPUT_WIDTH, SERVER_OUTPUT_HEIGHT, 60000);
+  if (version >= WL_OUTPUT_SCALE_SINCE_VERSION)
+    wl_output_send_scale(resource, 1);
+  if (version >= WL_OUTPUT_NAME_SINCE_VERSION)
+    wl_output_send_name(resource, "BENCH-1");
+  if (version >= WL_OUTPUT_DESCRIPTION_SINCE_VERSION)
+    wl_output_send_description(resource, "sinit benchmark output");
+  if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+    wl_output_send_done(resource);
+}
+
+/* xdg_wm_base */
+
+static void toplevel_set_app_id(struct wl_client *client,
+                                struct wl_resource *resource,
+                                const char *app_id) {
+  (void)client;
+  (void)resource;
+  (void)app_id;
+}
+
+// Requests sinit doesn't send are left unimplemented.
+static const struct xdg_toplevel_interface toplevel_impl = {
+    .destroy = resource_destroy,
+    .set_title = toplevel_set_app_id,
+    .set_app_id = toplevel_set_app_id,
+};
+
+static void toplevel_resource_destroy(struct wl_resource *resource) {
+  struct surface *surf = wl_resource_get_user_data(resource);
+  if (surf != NULL)
+    surf->toplevel = NULL;
+}
+
+static void xdg_surface_get_toplevel(struct wl_client *client,
+                                     struct wl_resource *resource,
+                                     uint32_t id) {
+  struct surface *surf = wl_resource_get_user_data(resource);
+  struct wl_resource *toplevel = resource_create(
+      client, &xdg_toplevel_interface, wl_resource_get_version(resource), id,
+      &toplevel_impl, surf, toplevel_resource_destroy);
+  if (toplevel == NULL || surf == NULL)
+    return;
+
+  surf->role = SURFACE_ROLE_TOPLEVEL;
+  surf->toplevel = toplevel;
+}
+
+static void xdg_surface_ack_configure(struct wl_client *client,
+                                      struct wl_resource *resource,
+                                      uint32_t serial) {
+  (void)client;
+  (void)resource;
+  (void)serial;
+}
+
+static const struct xdg_surface_interface xdg_surface_impl = {
+    .destroy = resource_destroy,
+    .get_toplevel = xdg_surface_get_toplevel,
+    .ack_configure = xdg_surface_ack_configure,
+};
+
+static void role_resource_destroy(struct wl_resource *resource) {
+  struct surface *surf = wl_resource_get_user_data(resource);
+  if (surf == NULL)
+    return;
+  surf->role = SURFACE_ROLE_NONE;
+  surf->role_resource = NULL;
+  surf->configured = false;
+}
+
+static void wm_base_get_xdg_surface(struct wl_client *client,
+                                    struct wl_resource *resource, uint32_t id,
+                                    struct wl_resource *surface) {
+  struct surface *surf = wl_resource_get_user_data(surface);
+  surf->role_resource = resource_create(
+      client, &xdg_surface_interface, wl_resource_get_version(resource), id,
+      &xdg_surface_impl, surf, role_resource_destroy);
+}
+
+static void wm_base_pong(struct wl_client *client,
+                         struct wl_resource *resource, uint32_t serial) {
+  (void)client;
+  (void)resource;
+  (void)serial;
+}
+
+static const struct xdg_wm_base_interface wm_base_impl = {
+    .destroy = resource_destroy,
+    .get_xdg_surface = wm_base_get_xdg_surface,
+    .pong = wm_base_pong,
+};
+
+static void bind_wm_base(struct wl_client *client, void *data,
+                         uint32_t version, uint32_t id) {
+  resource_create(client, &xdg_wm_base_interface, version, id, &wm_base_impl,
+                  data, NULL);
+}
+
+/* zwlr_layer_shell_v1 */
+
+static void layer_surface_set_size(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   uint32_t width, uint32_t height) {
+  (void)client;
+
+  struct surface *surf = wl_resource_get_user_data(resource);
+  if (surf == NULL)
+    return;
+  surf->width = width;
+  surf->height = height;
+}
+
+static void layer_surface_set_uint(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   uint32_t value) {
+  (void)client;
+  (void)resource;
+  (void)value;
+}
+
+static void layer_surface_set_exclusive_zone(struct wl_client *client,
+                                             struct wl_resource *resource,
+                                             int32_t zone) {
+  (void)client;
+  (void)resource;
+  (void)zone;
+}
+
+static void layer_surface_set_margin(struct wl_client *client,
+                                     struct wl_resource *resource, int32_t top,
+                                     int32_t right, int32_t bottom,
+                                     int32_t left) {
+  (void)client;
+  (void)resource;
+  (void)top;
+  (void)right;
+  (void)bottom;
+  (void)left;
+}
+
+static const struct zwlr_layer_surface_v1_interface layer_surface_impl = {
+    .set_size = layer_surface_set_size,
+    .set_anchor = layer_surface_set_uint,
+    .set_exclusive_zone = layer_surface_set_exclusive_zone,
+    .set_margin = layer_surface_set_margin,
+    .set_keyboard_interactivity = layer_surface_set_uint,
+    .ack_configure = layer_surface_set_uint,
+    .destroy = resource_destroy,
+    .set_layer = layer_surface_set_uint,
+};
+
+static void layer_shell_get_layer_surface(struct wl_client *client,
+                                          struct wl_resource *resource,
+                                          uint32_t id,
+                                          struct wl_resource *surface,
+                                          struct wl_resource *output,
+                                          uint32_t layer,
+                                          const char *namespace) {
+  (void)output;
+  (void)layer;
+  (void)namespace;
+
+  struct surface *surf = wl_resource_get_user_data(surface);
+  surf->role_resource = resource_create(
+      client, &zwlr_layer_surface_v1_interface,
+      wl_resource_get_version(resource), id, &layer_surface_impl, surf,
+      role_resource_destroy);
+  if (surf->role_resource != NULL)
+    surf->role = SURFACE_ROLE_LAYER;
+}
+
+static const struct zwlr_layer_shell_v1_interface layer_shell_impl = {
+    .get_layer_surface = layer_shell_get_layer_surface,
+    .destroy = resource_destroy,
+};
+
+static void bind_layer_shell(struct wl_client *client, void *data,
+                             uint32_t version, uint32_t id) {
+  resource_create(client, &zwlr_layer_shell_v1_interface, version, id,
+                  &layer_shell_impl, data, NULL);
+}
+
+/* wp_presentation */
+
+static void presentation_feedback(struct wl_client *client,
+                                  struct wl_resource *resource,
+                                  struct wl_resource *surface, uint32_t id) {
+  (void)resource;
+
+  struct surface *surf = wl_resource_get_user_data(surface);
+  struct wl_resource *feedback =
+      resource_create(client, &wp_presentation_feedback_interface, 1, id, NULL,
+                      NULL, resource_unlink);
+  if (feedback != NULL)
+    wl_list_insert(surf->feedbacks.prev, wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentation_impl = {
+    .destroy = resource_destroy,
+    .feedback = presentation_feedback,
+};
+
+static void bind_presentation(struct wl_client *client, void *data,
+                              uint32_t version, uint32_t id) {
+  struct wl_resource *resource =
+      resource_create(client, &wp_presentation_interface, version, id,
+                      &presentation_impl, data, NULL);
+  if (resource != NULL)
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+/* wp_viewporter */
+
+static void viewport_set_source(struct wl_client *client,
+                                struct wl_resource *resource, wl_fixed_t x,
+                                wl_fixed_t y, wl_fixed_t width,
+                                wl_fixed_t height) {
+  (void)client;
+  (void)resource;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+}
+
+static void viewport_set_destination(struct wl_client *client,
+                                     struct wl_resource *resource,
+                                     int32_t width, int32_t height) {
+  (void)client;
+  (void)resource;
+  (void)width;
+  (void)height;
+}
+
+static const struct wp_viewport_interface viewport_impl = {
+    .destroy = resource_destroy,
+    .set_source = viewport_set_source,
+    .set_destination = viewport_set_destination,
+};
+
+static void viewporter_get_viewport(struct wl_client *client,
+                                    struct wl_resource *resource, uint32_t id,
+                                    struct wl_resource *surface) {
+  (void)resource;
+  (void)surface;
+  resource_create(client, &wp_viewport_interface, 1, id, &viewport_impl, NULL,
+                  NULL);
+}
+
+static const struct wp_viewporter_interface viewporter_impl = {
+    .destroy = resource_destroy,
+    .get_viewport = viewporter_get_viewport,
+};
+
+static void bind_viewporter(struct wl_client *client, void *data,
+                            uint32_t version, uint32_t id) {
+  resource_create(client, &wp_viewporter_interface, version, id,
+                  &viewporter_impl, data, NULL);
+}
+
+/* wp_fractional_scale_manager_v1 */
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl = {
+    .destroy = resource_destroy,
+};
+
+static void fractional_scale_resource_destroy(struct wl_resource *resource) {
+  struct surface *surf = wl_resource_get_user_data(resource);
+  if (surf != NULL)
+    surf->fractional_scale = NULL;
+}
+
+static void
+fractional_scale_manager_get_fractional_scale(struct wl_client *client,
+                                              struct wl_resource *resource,
+                                              uint32_t id,
+                                              struct wl_resource *surface) {
+  (void)resource;
+
+  struct surface *surf = wl_resource_get_user_data(surface);
+  surf->fractional_scale = resource_create(
+      client, &wp_fractional_scale_v1_interface, 1, id, &fractional_scale_impl,
+      surf, fractional_scale_resource_destroy);
+}
+
+static const struct wp_fractional_scale_manager_v1_interface
+    fractional_scale_manager_impl = {
+        .destroy = resource_destroy,
+        .get_fractional_scale = fractional_scale_manager_get_fractional_scale,
+};
+
+static void bind_fractional_scale_manager(struct wl_client *client,
+                                          void *data, uint32_t version,
+                                          uint32_t id) {
+  resource_create(client, &wp_fractional_scale_manager_v1_interface, version,
+                  id, &fractional_scale_manager_impl, data, NULL);
+}
+
+/* Server */
+
+// Counts shm pools and buffers created by client.
+static void handle_resource_created(struct wl_listener *listener,
+                                    void *data) {
+  (void)listener;
+
+  const char *class = wl_resource_get_class(data);
+  if (strcmp(class, wl_shm_pool_interface.name) == 0)
+    atomic_fetch_add(&server_stats.pools, 1);
+  else if (strcmp(class, wl_buffer_interface.name) == 0)
+    atomic_fetch_add(&server_stats.buffers, 1);
+}
+
+static int handle_command(int fd, uint32_t mask, void *data) {
+  (void)mask;
+  (void)data;
+
+  struct server_command cmd;
+  while (read(fd, &cmd, sizeof(cmd)) == sizeof(cmd)) {
+    struct surface *surf;
+    switch (cmd.type) {
+    case SERVER_CONFIGURE:
+      wl_list_for_each(surf, &server.surfaces, link) {
+        if (surf->configured)
+          surface_configure(surf, cmd.width, cmd.height);
+      }
+      break;
+
+    case SERVER_SCALE:
+      wl_list_for_each(surf, &server.surfaces, link) {
+        surface_set_scale(surf, cmd.scale);
+      }
+      break;
+
+    case SERVER_STOP:
+      wl_display_terminate(server.display);
+      break;
+    }
+  }
+
+  return 0;
+}
+
+static void *server_main(void *data) {
+  (void)data;
+  wl_display_run(server.display);
+  return NULL;
+}
+
+static void server_send(struct server_command cmd) {
+  if (write(server.command_fds[1], &cmd, sizeof(cmd)) != sizeof(cmd))
+    LOG_FATAL("failed to send command to server: %m");
+}
+
+/**
+ * Starts server on a new thread and returns file descriptor of the client end
+ * of its connection. This function panics on error.
+ */
+int server_start(void) {
+  wl_list_init(&server.surfaces);
+  wl_list_init(&server.outputs);
+
+  server.display = wl_display_create();
+  if (server.display == NULL)
+    LOG_FATAL("failed to create wayland display");
+
+  if (wl_display_init_shm(server.display) < 0)
+    LOG_FATAL("failed to initialize wl_shm");
+
+  struct {
+    const struct wl_interface *interface;
+    int version;
+    wl_global_bind_func_t bind;
+  } globals[] = {
+      {&wl_compositor_interface, 6, bind_compositor},
+      {&wl_output_interface, 4, bind_output},
+      {&xdg_wm_base_interface, 1, bind_wm_base},
+      {&zwlr_layer_shell_v1_interface, 4, bind_layer_shell},
+      {&wp_presentation_interface, 1, bind_presentation},
+      {&wp_viewporter_interface, 1, bind_viewporter},
+      {&wp_fractional_scale_manager_v1_interface, 1,
+       bind_fractional_scale_manager},
+  };
+  for (size_t i = 0; i < ALEN(globals); i++) {
+    if (wl_global_create(server.display, globals[i].interface,
+                         globals[i].version, NULL, globals[i].bind) == NULL)
+      LOG_FATAL("failed to create %s global", globals[i].interface->name);
+  }
+
+  if (pipe2(server.command_fds, O_CLOEXEC | O_NONBLOCK) < 0)
+    LOG_FATAL("failed to create command pipe: %m");
+  wl_event_loop_add_fd(wl_display_get_event_loop(server.display),
+                       server.command_fds[0], WL_EVENT_READABLE,
+                       handle_command, NULL);
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    LOG_FATAL("failed to create socket pair: %m");
+
+  server.client = wl_client_create(server.display, fds[0]);
+  if (server.client == NULL)
+    LOG_FATAL("failed to create wayland client");
+  server.resource_created.notify = handle_resource_created;
+  wl_client_add_resource_created_listener(server.client,
+                                          &server.resource_created);
+
+  int r = pthread_create(&server.thread, NULL, server_main, NULL);
+  if (r != 0)
+    LOG_FATAL("failed to create server thread: %s", strerror(r));
+
+  return fds[1];
+}
+
+/**
+ * Sends a new size to all XDG toplevels and layer surfaces.
+ */
+void server_configure(int width, int height) {
+  server_send((struct server_command){
+      .type = SERVER_CONFIGURE, .width = width, .height = height});
+}
+
+/**
+ * Sends a new preferred scale, in 1/120 units, to all surfaces.
+ */
+void server_scale(uint32_t scale) {
+  server_send((struct server_command){.type = SERVER_SCALE, .scale = scale});
+}
+
+/**
+ * Stops server thread and frees its resources. Client must be disconnected.
+ */
+void server_stop(void) {
+  server_send((struct server_command){.type = SERVER_STOP});
+  pthread_join(server.thread, NULL);
+
+  wl_display_destroy_clients(server.display);
+  wl_display_destroy(server.display);
+  close(server.command_fds[0]);
+  close(server.command_fds[1]);
+}
@@ -0,0 +1,52 @@
+// Minimal in-process Wayland compositor used to benchmark sinit.
+
+#ifndef BENCH_SERVER_H_INCLUDE
+#define BENCH_SERVER_H_INCLUDE
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Output advertised by the server. Layer surfaces with a 0 size are
+ * configured with this size.
+ */
+#define SERVER_OUTPUT_WIDTH 3840
+#define SERVER_OUTPUT_HEIGHT 2160
+
+/**
+ * Counters updated by the server thread.
+ */
+struct server_stats {
+  atomic_uint_fast64_t commits;
+  atomic_uint_fast64_t configures;
+  atomic_uint_fast64_t pools;
+  atomic_uint_fast64_t buffers;
+  // Bytes of buffers attached and of damaged buffer areas committed.
+  atomic_uint_fast64_t attached_bytes;
+  atomic_uint_fast64_t damaged_bytes;
+};
+
+extern struct server_stats server_stats;
+
+/**
+ * Starts server on a new thread and returns file descriptor of the client end
+ * of its connection. This function panics on error.
+ */
+int server_start(void);
+
+/**
+ * Sends a new size to all XDG toplevels and layer surfaces.
+ */
+void server_configure(int width, int height);
+
+/**
+ * Sends a new preferred scale, in 1/120 units, to all surfaces.
+ */
+void server_scale(uint32_t scale);
+
+/**
+ * Stops server thread and frees its resources. Client must be disconnected.
+ */
+void server_stop(void);
+
+#endif
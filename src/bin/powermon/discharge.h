@@ -0,0 +1,108 @@
+// Battery discharge rate estimation and time-to-empty prediction.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number of samples kept per battery.
+#define DISCHARGE_SAMPLES_LEN 16
+// Samples further apart than this (e.g. across a suspend) start a new window,
+// in microseconds.
+#define DISCHARGE_MAX_GAP (10 * 60 * 1000000ull)
+// Minimum time span of window before a prediction is made, in microseconds.
+#define DISCHARGE_MIN_SPAN (2 * 60 * 1000000ull)
+
+// A battery sample.
+struct discharge_sample {
+  // Timestamp in microseconds.
+  uint64_t time;
+  float percentage;
+  // Energy drained from battery in W, 0 if unknown.
+  float energy_rate;
+};
+
+// Ring buffer of the most recent samples of a discharging battery.
+struct discharge {
+  struct discharge_sample samples[DISCHARGE_SAMPLES_LEN];
+  // Index of next sample.
+  unsigned head;
+  unsigned count;
+};
+
+// Drops all samples, e.g. when battery stops discharging.
+static void discharge_reset(struct discharge *d) {
+  d->head = 0;
+  d->count = 0;
+}
+
+// Appends a sample, overwriting the oldest one once ring is full.
+static void discharge_push(struct discharge *d, uint64_t time,
+                           double percentage, double energy_rate) {
+  if (d->count > 0) {
+    unsigned last =
+        (d->head + DISCHARGE_SAMPLES_LEN - 1) % DISCHARGE_SAMPLES_LEN;
+    uint64_t prev = d->samples[last].time;
+    if (time < prev || time - prev > DISCHARGE_MAX_GAP)
+      discharge_reset(d);
+  }
+
+  d->samples[d->head] = (struct discharge_sample){
+      .time = time,
+      .percentage = percentage,
+      .energy_rate = energy_rate > 0 ? energy_rate : 0,
+  };
+  d->head = (d->head + 1) % DISCHARGE_SAMPLES_LEN;
+  if (d->count < DISCHARGE_SAMPLES_LEN)
+    d->count++;
+}
+
+// Predicts minutes left before battery is empty. Discharge rate is the least
+// squares slope of percentage over the window. If UPower reports EnergyRate,
+// the rate is scaled by the ratio of the latest energy rate to the window
+// average so the prediction follows load changes immediately instead of
+// waiting for the regression to catch up. It returns false if there is not
+// enough data yet or battery isn't draining.
+static bool discharge_minutes_left(const struct discharge *d, double *minutes) {
+  if (d->count < 2)
+    return false;
+
+  unsigned first = (d->head + DISCHARGE_SAMPLES_LEN - d->count) %
+                   DISCHARGE_SAMPLES_LEN;
+  unsigned last = (d->head + DISCHARGE_SAMPLES_LEN - 1) % DISCHARGE_SAMPLES_LEN;
+  const struct discharge_sample *latest = &d->samples[last];
+  uint64_t t0 = d->samples[first].time;
+  if (latest->time - t0 < DISCHARGE_MIN_SPAN)
+    return false;
+
+  // Times are relative to the first sample and in seconds to keep sums
+  // accurate.
+  double sum_t = 0, sum_p = 0, sum_tt = 0, sum_tp = 0, sum_rate = 0;
+  unsigned n_rates = 0;
+  for (unsigned i = 0; i < d->count; i++) {
+    const struct discharge_sample *s =
+        &d->samples[(first + i) % DISCHARGE_SAMPLES_LEN];
+    double t = (s->time - t0) / 1e6;
+    sum_t += t;
+    sum_p += s->percentage;
+    sum_tt += t * t;
+    sum_tp += t * s->percentage;
+    if (s->energy_rate > 0) {
+      sum_rate += s->energy_rate;
+      n_rates++;
+    }
+  }
+
+  double n = d->count;
+  double denom = n * sum_tt - sum_t * sum_t;
+  if (denom <= 0)
+    return false;
+
+  // Percent per second, positive while draining.
+  double rate = -(n * sum_tp - sum_t * sum_p) / denom;
+  if (n_rates == d->count && latest->energy_rate > 0)
+    rate *= latest->energy_rate / (sum_rate / n_rates);
+  if (rate <= 0)
+    return false;
+
+  *minutes = latest->percentage / rate / 60;
+  return true;
+}
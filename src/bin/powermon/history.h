@@ -0,0 +1,278 @@
+// Battery history stored in a fixed-record ring file.
+//
+// File is $XDG_STATE_HOME/powermon/history (~/.local/state by default) and
+// is mapped in memory, appending a sample is a plain memory write and the
+// kernel writes dirty pages back on its own. Once file is full, oldest
+// records are overwritten. Only one process may write to history at a time.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef LOG_MODULE
+#define LOG_MODULE "history"
+#endif
+#include "log.h"
+
+#define HISTORY_MAGIC "PWRHIST"
+#define HISTORY_VERSION 1
+// Number of records of history file, about 1.5 MiB. At UPower refresh rate
+// this is weeks of continuous discharge.
+#define HISTORY_CAPACITY (64 * 1024)
+
+// A battery sample.
+struct history_record {
+  // Wall clock time in microseconds since epoch. It never decreases from one
+  // record to the next, even if clock is set backward.
+  int64_t time;
+  // Identifier of battery, derived from its UPower object path.
+  uint32_t battery;
+  float percentage;
+  // Energy drained from battery in W, 0 if unknown.
+  float energy_rate;
+  // enum upower_state.
+  uint32_t state;
+};
+
+// Header of history file, records follow.
+struct history_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  // Number of records ever appended, next record is at head % capacity.
+  uint64_t head;
+};
+
+// A mapped history file.
+struct history {
+  struct history_header *header;
+  struct history_record *records;
+  size_t size;
+  // File descriptor holding the writer lock, -1 if history is read-only.
+  int fd;
+};
+
+// Creates directories of path, last component excluded.
+static int history_mkdirs(char *path) {
+  for (char *c = path + 1; *c != '\0'; c++) {
+    if (*c != '/')
+      continue;
+
+    *c = '\0';
+    int r = mkdir(path, 0700);
+    *c = '/';
+    if (r < 0 && errno != EEXIST)
+      return -1;
+  }
+
+  return 0;
+}
+
+// Returns path of history file, it must be freed. NULL is returned if
+// neither XDG_STATE_HOME nor HOME are set.
+static char *history_path(void) {
+  char *path = NULL;
+  const char *state = getenv("XDG_STATE_HOME");
+  const char *home = getenv("HOME");
+
+  int r = -1;
+  if (state != NULL && state[0] == '/')
+    r = asprintf(&path, "%s/powermon/history", state);
+  else if (home != NULL)
+    r = asprintf(&path, "%s/.local/state/powermon/history", home);
+
+  return r < 0 ? NULL : path;
+}
+
+// Returns whether header describes a history file of this version with the
+// given size.
+static bool history_header_valid(const struct history_header *header,
+                                 size_t size) {
+  return memcmp(header->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) == 0 &&
+         header->version == HISTORY_VERSION &&
+         header->record_size == sizeof(struct history_record) &&
+         header->capacity > 0 &&
+         size == sizeof(*header) +
+                     header->capacity * sizeof(struct history_record);
+}
+
+// Maps history file. If writable, file is created or reset if it is missing
+// or invalid. It returns false on error, history is then unusable.
+bool history_open(struct history *history, bool writable) {
+  *history = (struct history){.fd = -1};
+
+  char *path = history_path();
+  if (path == NULL) {
+    LOG_ERR("failed to locate history file: XDG_STATE_HOME and HOME unset");
+    return false;
+  }
+
+  bool ok = false;
+  int fd = -1;
+  if (writable && history_mkdirs(path) < 0) {
+    LOG_ERR("failed to create directory of history file %s: %m", path);
+    goto out;
+  }
+
+  fd = open(path, (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    LOG_ERR("failed to open history file %s: %m", path);
+    goto out;
+  }
+
+  // Lock is held until history is closed, concurrent writers would corrupt
+  // head.
+  if (writable && flock(fd, LOCK_EX | LOCK_NB) < 0) {
+    if (errno == EWOULDBLOCK)
+      LOG_ERR("history file %s is used by another process", path);
+    else
+      LOG_ERR("failed to lock history file %s: %m", path);
+    goto out;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG_ERR("failed to stat history file %s: %m", path);
+    goto out;
+  }
+
+  struct history_header header = {0};
+  bool valid = (size_t)st.st_size >= sizeof(header) &&
+               pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+               history_header_valid(&header, st.st_size);
+
+  history->size = sizeof(header) +
+                  (size_t)HISTORY_CAPACITY * sizeof(struct history_record);
+  if (valid) {
+    history->size = st.st_size;
+  } else if (!writable) {
+    LOG_ERR("history file %s is missing or invalid", path);
+    goto out;
+  } else {
+    if (st.st_size != 0)
+      LOG_WARN("history file %s is invalid, resetting it", path);
+
+    // Truncate first so stale records read back as zeroes.
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, history->size) < 0) {
+      LOG_ERR("failed to resize history file %s: %m", path);
+      goto out;
+    }
+  }
+
+  void *map = mmap(NULL, history->size,
+                   writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                   fd, 0);
+  if (map == MAP_FAILED) {
+    LOG_ERR("failed to map history file %s: %m", path);
+    goto out;
+  }
+
+  history->header = map;
+  history->records = (struct history_record *)(history->header + 1);
+  if (!valid) {
+    memcpy(history->header->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+    history->header->version = HISTORY_VERSION;
+    history->header->record_size = sizeof(struct history_record);
+    history->header->capacity = HISTORY_CAPACITY;
+    history->header->head = 0;
+  }
+
+  LOG_DBG("history file %s opened, %llu records appended", path,
+          (unsigned long long)history->header->head);
+  ok = true;
+  if (writable) {
+    history->fd = fd;
+    fd = -1;
+  }
+
+out:
+  if (fd >= 0)
+    close(fd);
+  free(path);
+  return ok;
+}
+
+// Unmaps history file, pending writes are written back by the kernel.
+void history_close(struct history *history) {
+  if (history->header != NULL)
+    munmap(history->header, history->size);
+  if (history->fd >= 0)
+    close(history->fd);
+  *history = (struct history){.fd = -1};
+}
+
+// Appends a record, overwriting the oldest one if file is full. Record time
+// is clamped to the time of previous record so history stays sorted for
+// history_query() if clock is set backward. Record is written before head is
+// published so readers never see a partial record at the end of the history.
+void history_append(struct history *history,
+                    const struct history_record *record) {
+  struct history_header *header = history->header;
+  uint64_t head = header->head;
+  struct history_record *slot = &history->records[head % header->capacity];
+
+  *slot = *record;
+  if (head > 0) {
+    int64_t prev = history->records[(head - 1) % header->capacity].time;
+    if (slot->time < prev)
+      slot->time = prev;
+  }
+
+  __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Returns record at logical index i, 0 being the oldest record kept.
+static const struct history_record *
+history_at(const struct history *history, uint64_t head, uint64_t i) {
+  uint64_t capacity = history->header->capacity;
+  uint64_t first = head > capacity ? head - capacity : 0;
+  return &history->records[(first + i) % capacity];
+}
+
+// Callback called for each record of a history query. Returning false stops
+// the query.
+typedef bool (*history_record_cb)(const struct history_record *record,
+                                  void *data);
+
+// Calls cb with records whose time is in [from, to], oldest first. Records
+// are appended in time order so the start of the range is found with a
+// binary search, the query costs O(log n) plus the size of the range. It
+// returns the number of records visited.
+uint64_t history_query(const struct history *history, int64_t from,
+                       int64_t to, history_record_cb cb, void *data) {
+  uint64_t head = __atomic_load_n(&history->header->head, __ATOMIC_ACQUIRE);
+  uint64_t count =
+      head < history->header->capacity ? head : history->header->capacity;
+
+  // First record not older than from.
+  uint64_t lo = 0, hi = count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (history_at(history, head, mid)->time < from)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  uint64_t visited = 0;
+  for (uint64_t i = lo; i < count; i++) {
+    const struct history_record *record = history_at(history, head, i);
+    if (record->time > to)
+      break;
+
+    visited++;
+    if (!cb(record, data))
+      break;
+  }
+
+  return visited;
+}
@@ -3,7 +3,15 @@
  * and send a desktop notification on low battery. powermon depends on UPower
  * D-Bus service.
  *
- * Adding/removing batteries is not supported for the moment.
+ * Battery is considered low once its predicted time-to-empty, estimated from
+ * the recent discharge rate, falls under a threshold. Until enough samples are
+ * collected, it falls back to UPower battery level and a 20% threshold.
+ *
+ * Every battery change is recorded in a history file (see history.h) that
+ * survives restarts and can be dumped with --history.
+ *
+ * Batteries added or removed (e.g. docked UPS or Bluetooth peripherals) while
+ * powermon runs are tracked through UPower DeviceAdded/DeviceRemoved signals.
  *
  * Note that powermon is not robust and panic on every error, it is recommended
  * to run it with a restart on failure policy.
@@ -14,6 +22,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <systemd/sd-bus.h>
@@ -23,23 +33,51 @@
 #define LOG_MODULE "main"
 #include "log.h"
 
+#include "discharge.h"
 #include "error.h"
+#include "history.h"
 #include "notify.h"
-#include "tllist.h"
 
 #include "upower.h"
 
+// Default time-to-empty under which battery is low, in minutes.
+#define LOW_BATTERY_MINUTES 15
+// Percentage under which battery is low when time-to-empty is unknown.
+#define LOW_BATTERY_PERCENTAGE 20.0
+
+// Minimum number of buckets of battery table.
+#define BATTERY_TABLE_MIN_LEN 8
+
 /**
  * Battery data.
  */
-typedef struct {
+typedef struct battery_data {
   struct powermon_data *powermon;
+  // Pending Properties.GetAll call if properties of device weren't retrieved
+  // yet, PropertiesChanged match otherwise.
   sd_bus_slot *slot;
-  double percentage;
-  uint32_t level;
-  uint32_t state;
+  bool pending;
+  struct upower_device device;
+  struct discharge discharge;
+  // Battery identifier in history records.
+  uint32_t history_id;
+  // Next battery of battery table bucket.
+  struct battery_data *next;
+  // UPower object path.
+  char path[];
 } battery_data;
 
+/**
+ * Batteries, and devices not known to be batteries yet, indexed by UPower
+ * object path. It is a chained hash table whose
+ * length is a power of two.
+ */
+typedef struct {
+  battery_data **buckets;
+  size_t len;
+  size_t count;
+} battery_table;
+
 /**
  * powermon state.
  */
@@ -47,8 +85,16 @@ typedef struct powermon_data {
   sd_event *loop;
   sd_bus *system_bus;
   sd_bus *user_bus;
-  tll(battery_data *) batteries;
+  sd_bus_slot *device_added_slot;
+  sd_bus_slot *device_removed_slot;
+  battery_table batteries;
   uint32_t notif_id;
+  // Battery that raised 'Low battery' notification.
+  battery_data *notif_battery;
+  // Time-to-empty under which battery is low, in minutes.
+  unsigned low_minutes;
+  // Battery history, header is NULL if it is disabled.
+  struct history history;
 } powermon_data;
 
 // Print CLI usage.
@@ -65,6 +111,10 @@ static void print_usage(char *prog_name) {
       "exit\n"
       "  -l, --log-level                          Set log level (one of "
       "'debug', 'info', 'warning', 'error', 'none')\n"
+      "  -m, --low-minutes                        Notify when predicted "
+      "time-to-empty is under this many minutes (default 15)\n"
+      "  -H, --history                            Print battery history of "
+      "the last given hours and exit\n"
       "";
 
   puts(header);
@@ -72,72 +122,147 @@ static void print_usage(char *prog_name) {
   puts(options);
 }
 
+// FNV-1a hash of an object path.
+static uint64_t path_hash(const char *path) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *path != '\0'; path++) {
+    hash ^= (unsigned char)*path;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Returns bucket of battery table that contains path.
+static battery_data **battery_table_bucket(battery_table *table,
+                                           const char *path) {
+  return &table->buckets[path_hash(path) & (table->len - 1)];
+}
+
+// Returns battery with the given path or NULL.
+static battery_data *battery_table_get(battery_table *table,
+                                       const char *path) {
+  if (table->len == 0)
+    return NULL;
+
+  battery_data *battery = *battery_table_bucket(table, path);
+  while (battery != NULL && strcmp(battery->path, path) != 0)
+    battery = battery->next;
+  return battery;
+}
+
+// Rehashes battery table into len buckets.
+static void battery_table_resize(battery_table *table, size_t len) {
+  battery_data **buckets = calloc(len, sizeof(*buckets));
+  if (buckets == NULL)
+    LOG_FATAL("failed to allocate battery table");
+
+  for (size_t i = 0; i < table->len; i++) {
+    battery_data *battery = table->buckets[i];
+    while (battery != NULL) {
+      battery_data *next = battery->next;
+      battery_data **bucket = &buckets[path_hash(battery->path) & (len - 1)];
+      battery->next = *bucket;
+      *bucket = battery;
+      battery = next;
+    }
+  }
+
+  free(table->buckets);
+  table->buckets = buckets;
+  table->len = len;
+}
+
+// Inserts battery, there must be no battery with the same path already.
+static void battery_table_insert(battery_table *table, battery_data *battery) {
+  if (table->count >= table->len)
+    battery_table_resize(table, table->len == 0 ? BATTERY_TABLE_MIN_LEN
+                                                : table->len * 2);
+
+  battery_data **bucket = battery_table_bucket(table, battery->path);
+  battery->next = *bucket;
+  *bucket = battery;
+  table->count++;
+}
+
+// Removes and returns battery with the given path, NULL if there is none.
+static battery_data *battery_table_remove(battery_table *table,
+                                          const char *path) {
+  if (table->len == 0)
+    return NULL;
+
+  battery_data **it = battery_table_bucket(table, path);
+  while (*it != NULL && strcmp((*it)->path, path) != 0)
+    it = &(*it)->next;
+
+  battery_data *battery = *it;
+  if (battery != NULL) {
+    *it = battery->next;
+    table->count--;
+  }
+  return battery;
+}
+
+// Stops watching battery, or cancels retrieval of its properties, and frees
+// it.
+static void battery_free(battery_data *battery) {
+  sd_bus_slot_unref(battery->slot);
+  free(battery);
+}
+
 // Battery property changed event handler.
 static int on_battery_changed(sd_bus_message *m, void *userdata,
                               sd_bus_error *ret_error) {
   (void)ret_error;
 
-  const char *interface = NULL;
   battery_data *battery = userdata;
+  powermon_data *powermon = battery->powermon;
   notification notif = {0};
 
-  // Read interface.
-  SDBUS_PANIC(sd_bus_message_read(m, "s", &interface),
+  // Skip interface, match rule only lets org.freedesktop.UPower.Device
+  // through.
+  SDBUS_PANIC(sd_bus_message_skip(m, "s"),
               "failed to read interface of PropertiesChanged signal");
-  LOG_DBG("signal on interface %s", interface);
-
-  // Not UPower device.
-  if (strcmp(interface, "org.freedesktop.UPower.Device") != 0)
-    return 0;
-
-  SDBUS_PANIC(sd_bus_message_enter_container(m, 'a', "{sv}"),
-              "failed to enter battery changed container");
 
   // Sync changed properties.
-  while (sd_bus_message_enter_container(m, 'e', "sv") > 0) {
-    const char *key;
-    SDBUS_PANIC(sd_bus_message_read(m, "s", &key),
-                "failed to read PropertiesChanged dict key");
-
-    LOG_DBG("battery property '%s' changed", key);
-
-    if (strcmp(key, "State") == 0) {
-      SDBUS_PANIC(sd_bus_message_enter_container(m, 'v', "u"),
-                  "failed to enter 'State' variant");
-
-      SDBUS_PANIC(sd_bus_message_read(m, "u", &battery->state),
-                  "failed to read changed property 'State' of UPower battery");
-
-      sd_bus_message_exit_container(m);
-    } else if (strcmp(key, "BatteryLevel") == 0) {
-      SDBUS_PANIC(sd_bus_message_enter_container(m, 'v', "u"),
-                  "failed to enter 'BatteryLevel' variant");
-
-      SDBUS_PANIC(
-          sd_bus_message_read(m, "u", &battery->level),
-          "failed to read changed property 'BatteryLevel' of UPower battery");
-
-      sd_bus_message_exit_container(m);
-    } else if (strcmp(key, "Percentage") == 0) {
-      SDBUS_PANIC(sd_bus_message_enter_container(m, 'v', "d"),
-                  "failed to enter 'Percentage' variant");
-
-      SDBUS_PANIC(
-          sd_bus_message_read(m, "d", &battery->percentage),
-          "failed to read changed property 'Percentage' of UPower battery");
-
-      sd_bus_message_exit_container(m);
-    } else {
-      SDBUS_PANIC(sd_bus_message_skip(m, NULL),
-                  "failed to skip PropertiesChanged dict entry");
-    }
-
-    sd_bus_message_exit_container(m);
+  SDBUS_PANIC(upower_device_read(m, &battery->device),
+              "failed to read changed properties of UPower battery");
+
+  // Record change, event loop time is cached so this is syscall free.
+  if (powermon->history.header != NULL) {
+    uint64_t now = 0;
+    SDEV_PANIC(sd_event_now(powermon->loop, CLOCK_REALTIME, &now),
+               "failed to read event loop time");
+    history_append(&powermon->history,
+                   &(struct history_record){
+                       .time = now,
+                       .battery = battery->history_id,
+                       .percentage = battery->device.percentage,
+                       .energy_rate = battery->device.energy_rate,
+                       .state = battery->device.state,
+                   });
   }
 
-  if (battery->state == UPOWER_STATE_DISCHARGING) {
-    if (battery->level == UPOWER_BATTERY_LEVEL_LOW ||
-        battery->percentage < 20.0) {
+  if (battery->device.state == UPOWER_STATE_DISCHARGING) {
+    uint64_t now = 0;
+    SDEV_PANIC(sd_event_now(powermon->loop, CLOCK_BOOTTIME, &now),
+               "failed to read event loop time");
+    discharge_push(&battery->discharge, now, battery->device.percentage,
+                   battery->device.energy_rate);
+
+    double minutes = 0;
+    bool predicted = discharge_minutes_left(&battery->discharge, &minutes);
+    if (predicted)
+      LOG_DBG("battery '%s' predicted time-to-empty: %.0f minutes",
+              battery->path, minutes);
+
+    bool low = battery->device.level == UPOWER_BATTERY_LEVEL_LOW ||
+               battery->device.level == UPOWER_BATTERY_LEVEL_CRITICAL;
+    if (predicted)
+      low = low || minutes < powermon->low_minutes;
+    else
+      low = low || battery->device.percentage < LOW_BATTERY_PERCENTAGE;
+
+    if (low) {
       LOG_INFO("Low battery, sending notification");
 
       notif.app = "dev.negrel.desk.powermon";
@@ -147,20 +272,34 @@ static int on_battery_changed(sd_bus_message *m, void *userdata,
       notif.n_hints = 1;
       notif.replace_id = battery->powermon->notif_id;
 
-      ERRNO_PANIC(asprintf((char **)&notif.body,
-                           "Please charge now, %.0f%% remaining.",
-                           battery->percentage),
-                  "failed to allocated notification body");
+      if (predicted) {
+        ERRNO_PANIC(asprintf((char **)&notif.body,
+                             "Please charge now, %.0f%% remaining (about %.0f "
+                             "minutes).",
+                             battery->device.percentage, minutes),
+                    "failed to allocated notification body");
+      } else {
+        ERRNO_PANIC(asprintf((char **)&notif.body,
+                             "Please charge now, %.0f%% remaining.",
+                             battery->device.percentage),
+                    "failed to allocated notification body");
+      }
 
       SDBUS_PANIC(notify(battery->powermon->user_bus, &notif,
                          &battery->powermon->notif_id, NULL),
                   "failed to send 'Low battery' notification");
+      powermon->notif_battery = battery;
     }
   } else {
-    if (battery->powermon->notif_id != 0) {
-      SDBUS_PANIC(notification_close(battery->powermon->user_bus,
-                                     battery->powermon->notif_id, NULL),
+    discharge_reset(&battery->discharge);
+
+    // Notification may belong to another battery still discharging.
+    if (powermon->notif_battery == battery) {
+      SDBUS_PANIC(notification_close(powermon->user_bus, powermon->notif_id,
+                                     NULL),
                   "failed to close 'Low battery' notification");
+      powermon->notif_id = 0;
+      powermon->notif_battery = NULL;
     }
   }
 
@@ -170,54 +309,103 @@ static int on_battery_changed(sd_bus_message *m, void *userdata,
   return 0;
 }
 
-// Watch battery.
-static void watch_battery(sd_bus *bus, const char *path, void *data) {
+// Watch battery whose properties were retrieved by track_device().
+static void watch_battery(sd_bus *bus, const char *path,
+                          const struct upower_device *device, void *data) {
+  powermon_data *powermon = data;
+  battery_data *battery = battery_table_get(&powermon->batteries, path);
+
+  // Properties call is done, its data (including path) is freed once this
+  // callback returns.
+  sd_bus_slot_unref(battery->slot);
+  battery->slot = NULL;
+  battery->pending = false;
+
+  // Not a battery.
+  if (device == NULL) {
+    battery_free(battery_table_remove(&powermon->batteries, path));
+    return;
+  }
+
+  battery->device = *device;
+  upower_watch_device(bus, &battery->slot, path, on_battery_changed, battery);
+
+  LOG_INFO("watching battery '%s' percentage=%f level=%d state=%d "
+           "history=%08x",
+           path, battery->device.percentage, battery->device.level,
+           battery->device.state, battery->history_id);
+}
+
+// Retrieves properties of UPower device enumerated or added and watches it
+// if it is a battery. Device is tracked until then so that its removal
+// cancels the retrieval.
+static void track_device(sd_bus *bus, const char *path, void *data) {
   powermon_data *powermon = data;
-  battery_data *battery = calloc(1, sizeof(*battery));
+
+  // Device was both enumerated and added.
+  if (battery_table_get(&powermon->batteries, path) != NULL)
+    return;
+
+  size_t len = strlen(path) + 1;
+  battery_data *battery = calloc(1, sizeof(*battery) + len);
   if (battery == NULL)
     LOG_FATAL("failed to allocated battery data");
-  tll_push_back(powermon->batteries, battery);
+  memcpy(battery->path, path, len);
+  battery->history_id = path_hash(path);
   battery->powermon = powermon;
+  battery->pending = true;
+  battery_table_insert(&powermon->batteries, battery);
+
+  upower_get_battery(bus, &battery->slot, path, watch_battery, powermon);
+}
+
+// UPower device added event handler.
+static int on_device_added(sd_bus_message *m, void *userdata,
+                           sd_bus_error *ret_error) {
+  (void)ret_error;
+
+  powermon_data *powermon = userdata;
+  const char *path = NULL;
+  SDBUS_PANIC(sd_bus_message_read(m, "o", &path),
+              "failed to read path of DeviceAdded signal");
+
+  LOG_DBG("UPower device '%s' added", path);
+  track_device(powermon->system_bus, path, powermon);
+  return 0;
+}
+
+// UPower device removed event handler.
+static int on_device_removed(sd_bus_message *m, void *userdata,
+                             sd_bus_error *ret_error) {
+  (void)ret_error;
+
+  powermon_data *powermon = userdata;
+  const char *path = NULL;
+  SDBUS_PANIC(sd_bus_message_read(m, "o", &path),
+              "failed to read path of DeviceRemoved signal");
+
+  battery_data *battery = battery_table_remove(&powermon->batteries, path);
+  if (battery == NULL)
+    return 0;
 
-  sd_bus_message *reply = NULL;
-
-  // Retrieve percentage.
-  SDBUS_PANIC(sd_bus_get_property(bus, "org.freedesktop.UPower", path,
-                                  "org.freedesktop.UPower.Device", "Percentage",
-                                  NULL, &reply, "d"),
-              "failed to get 'Percentage' property of UPower battery");
-  SDBUS_PANIC(sd_bus_message_read(reply, "d", &battery->percentage),
-              "failed to read 'Percentage' property of UPower battery");
-  sd_bus_message_unref(reply);
-
-  // Retrieve battery level.
-  SDBUS_PANIC(sd_bus_get_property(bus, "org.freedesktop.UPower", path,
-                                  "org.freedesktop.UPower.Device",
-                                  "BatteryLevel", NULL, &reply, "u"),
-              "failed to get 'BatteryLevel' property of UPower battery");
-  SDBUS_PANIC(sd_bus_message_read(reply, "u", &battery->level),
-              "failed to read 'BatteryLevel' property of UPower battery");
-
-  sd_bus_message_unref(reply);
-
-  // Retrieve state.
-  SDBUS_PANIC(sd_bus_get_property(bus, "org.freedesktop.UPower", path,
-                                  "org.freedesktop.UPower.Device", "State",
-                                  NULL, &reply, "u"),
-              "failed to get 'State' property of UPower battery");
-  SDBUS_PANIC(sd_bus_message_read(reply, "u", &battery->state),
-              "failed to read 'State' property of UPower battery");
-  sd_bus_message_unref(reply);
-
-  // Watch for changes.
-  SDBUS_PANIC(sd_bus_match_signal(bus, &battery->slot, "org.freedesktop.UPower",
-                                  path, "org.freedesktop.DBus.Properties",
-                                  "PropertiesChanged", on_battery_changed,
-                                  battery),
-              "failed to watch UPower battery for property change");
-
-  LOG_INFO("watching battery '%s' percentage=%f level=%d state=%d", path,
-           battery->percentage, battery->level, battery->state);
+  if (battery->pending)
+    LOG_DBG("UPower device '%s' removed before its properties were received",
+            path);
+  else
+    LOG_INFO("battery '%s' removed", path);
+
+  // Notification would otherwise stay until another battery stops
+  // discharging.
+  if (powermon->notif_battery == battery) {
+    SDBUS_PANIC(notification_close(powermon->user_bus, powermon->notif_id,
+                                   NULL),
+                "failed to close 'Low battery' notification");
+    powermon->notif_id = 0;
+    powermon->notif_battery = NULL;
+  }
+
+  battery_free(battery);
+  return 0;
 }
 
 static int on_signal(sd_event_source *s, const struct signalfd_siginfo *si,
@@ -233,20 +421,58 @@ static int on_signal(sd_event_source *s, const struct signalfd_siginfo *si,
   return 0;
 }
 
+// Prints a history record as a tab separated line.
+static bool print_history_record(const struct history_record *record,
+                                 void *data) {
+  (void)data;
+
+  time_t secs = record->time / 1000000;
+  struct tm tm;
+  char date[32] = {0};
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+           localtime_r(&secs, &tm));
+
+  printf("%s\t%08x\t%.2f\t%.2f\t%u\n", date, record->battery,
+         record->percentage, record->energy_rate, record->state);
+  return true;
+}
+
+// Prints battery history of the last hours.
+static int print_history(unsigned long hours) {
+  struct history history;
+  if (!history_open(&history, false))
+    return EXIT_FAILURE;
+
+  struct timespec ts;
+  ERRNO_PANIC(clock_gettime(CLOCK_REALTIME, &ts), "failed to read clock");
+  int64_t now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  puts("time\tbattery\tpercentage\tenergy_rate\tstate");
+  history_query(&history, now - (int64_t)hours * 3600 * 1000000, now,
+                print_history_record, NULL);
+
+  history_close(&history);
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
   // Parse args.
   char *prog_name = argv[0];
   enum log_class log_level = LOG_CLASS_INFO;
   bool daemonize = false;
+  unsigned low_minutes = LOW_BATTERY_MINUTES;
+  unsigned long history_hours = 0;
   while (1) {
     static struct option long_options[] = {
         {"daemon", no_argument, 0, 'd'},
         {"help", no_argument, 0, 'h'},
         {"log-level", required_argument, 0, 'l'},
+        {"low-minutes", required_argument, 0, 'm'},
+        {"history", required_argument, 0, 'H'},
         {0, 0, 0, 0},
     };
 
-    int c = getopt_long(argc, argv, "dhl:", long_options, NULL);
+    int c = getopt_long(argc, argv, "dhl:m:H:", long_options, NULL);
     if (c == -1)
       break;
 
@@ -268,6 +494,30 @@ int main(int argc, char **argv) {
       }
       break;
 
+    case 'm': {
+      char *end = NULL;
+      unsigned long minutes = strtoul(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || minutes > 24 * 60) {
+        fprintf(stderr, "invalid low battery minutes\n");
+        print_usage(prog_name);
+        return EXIT_FAILURE;
+      }
+      low_minutes = minutes;
+      break;
+    }
+
+    case 'H': {
+      char *end = NULL;
+      history_hours = strtoul(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || history_hours == 0 ||
+          history_hours > 100 * 365 * 24) {
+        fprintf(stderr, "invalid history hours\n");
+        print_usage(prog_name);
+        return EXIT_FAILURE;
+      }
+      break;
+    }
+
     default:
       BUG("unhandled option -%c", c);
     }
@@ -278,11 +528,18 @@ int main(int argc, char **argv) {
            daemonize ? LOG_FACILITY_DAEMON : LOG_FACILITY_USER, log_level);
   LOG_DBG("log initialized");
 
+  if (history_hours != 0)
+    return print_history(history_hours);
+
   // Run as daemon.
   if (daemonize)
     ERRNO_PANIC(daemon(0, 0), "failed to daemonize process");
 
-  powermon_data powermon = {0};
+  powermon_data powermon = {.low_minutes = low_minutes};
+
+  // History is optional, powermon still notifies without it.
+  if (!history_open(&powermon.history, true))
+    LOG_WARN("battery history disabled");
   sd_event_source *signal_source = NULL;
 
   // Initialize event loop.
@@ -318,18 +575,40 @@ int main(int argc, char **argv) {
                                   SD_EVENT_PRIORITY_NORMAL),
               "failed to attach user bus handle to event loop");
 
-  // Setup watch on all batteries.
-  for_all_batteries(powermon.system_bus, &powermon, watch_battery);
+  // Watch for batteries hotplug. Matches are sent before enumeration so no
+  // device is missed.
+  SDBUS_PANIC(sd_bus_match_signal_async(
+                  powermon.system_bus, &powermon.device_added_slot,
+                  "org.freedesktop.UPower", "/org/freedesktop/UPower",
+                  "org.freedesktop.UPower", "DeviceAdded", on_device_added,
+                  NULL, &powermon),
+              "failed to watch UPower for added devices");
+  SDBUS_PANIC(sd_bus_match_signal_async(
+                  powermon.system_bus, &powermon.device_removed_slot,
+                  "org.freedesktop.UPower", "/org/freedesktop/UPower",
+                  "org.freedesktop.UPower", "DeviceRemoved",
+                  on_device_removed, NULL, &powermon),
+              "failed to watch UPower for removed devices");
+
+  // Setup watch on all batteries, they are added from the event loop.
+  for_all_devices(powermon.system_bus, &powermon, track_device);
 
   // Run event loop.
   SDEV_PANIC(sd_event_loop(powermon.loop), "event loop failed");
 
   // Clean up.
-  tll_foreach(powermon.batteries, it) {
-    sd_bus_slot_unref(it->item->slot);
-    free(it->item);
-    tll_remove(powermon.batteries, it);
+  for (size_t i = 0; i < powermon.batteries.len; i++) {
+    battery_data *battery = powermon.batteries.buckets[i];
+    while (battery != NULL) {
+      battery_data *next = battery->next;
+      battery_free(battery);
+      battery = next;
+    }
   }
+  free(powermon.batteries.buckets);
+  history_close(&powermon.history);
+  sd_bus_slot_unref(powermon.device_added_slot);
+  sd_bus_slot_unref(powermon.device_removed_slot);
   if (powermon.system_bus)
     sd_bus_unref(powermon.system_bus);
   if (powermon.user_bus)
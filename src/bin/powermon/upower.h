@@ -1,5 +1,8 @@
 // UPower data types and helper functions.
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <systemd/sd-bus.h>
 
 #include "error.h"
@@ -67,38 +70,243 @@ enum upower_battery_level {
   UPOWER_BATTERY_LEVEL_FULL,
 };
 
-void for_all_batteries(sd_bus *bus, void *data,
-                       void (*cb)(sd_bus *bus, const char *path, void *data)) {
-  sd_bus_message *reply = NULL;
+// Properties of a UPower device used by powermon.
+struct upower_device {
+  uint32_t type;
+  double percentage;
+  // Rate at which energy is drained from battery in W, 0 if unknown.
+  double energy_rate;
+  uint32_t level;
+  uint32_t state;
+};
 
-  SDBUS_PANIC(sd_bus_call_method(bus, "org.freedesktop.UPower",
-                                 "/org/freedesktop/UPower",
-                                 "org.freedesktop.UPower", "EnumerateDevices",
-                                 NULL, &reply, ""),
-              "failed to call UPower method to enumerate devices");
+// UPower device properties decoded by upower_device_read().
+enum upower_property {
+  UPOWER_PROPERTY_UNKNOWN = 0,
+  UPOWER_PROPERTY_TYPE,
+  UPOWER_PROPERTY_STATE,
+  UPOWER_PROPERTY_BATTERY_LEVEL,
+  UPOWER_PROPERTY_PERCENTAGE,
+  UPOWER_PROPERTY_ENERGY_RATE,
+};
+
+// Perfect hash of decoded property names.
+#define UPOWER_PROPERTY_HASH(len, first) (((len) ^ (first)) & 15)
+
+// Entry of property table, indexed by UPOWER_PROPERTY_HASH() of name. first
+// is the first character of name.
+#define UPOWER_PROPERTY_ENTRY(first, name, property)                           \
+  [UPOWER_PROPERTY_HASH(sizeof(name) - 1, first)] = {name, sizeof(name) - 1,   \
+                                                     property}
+
+// Returns property named key. Hash of decoded property names, computed from
+// length and first character, is collision free. Other keys may share a slot
+// with them, so lengths are compared before a single memcmp confirms the
+// match; the dozens of other properties UPower sends are rejected without
+// comparing strings most of the time.
+static enum upower_property upower_property_lookup(const char *key) {
+  static const struct {
+    const char *name;
+    size_t len;
+    enum upower_property property;
+  } properties[16] = {
+      UPOWER_PROPERTY_ENTRY('T', "Type", UPOWER_PROPERTY_TYPE),
+      UPOWER_PROPERTY_ENTRY('S', "State", UPOWER_PROPERTY_STATE),
+      UPOWER_PROPERTY_ENTRY('P', "Percentage", UPOWER_PROPERTY_PERCENTAGE),
+      UPOWER_PROPERTY_ENTRY('E', "EnergyRate", UPOWER_PROPERTY_ENERGY_RATE),
+      UPOWER_PROPERTY_ENTRY('B', "BatteryLevel", UPOWER_PROPERTY_BATTERY_LEVEL),
+  };
+
+  size_t len = strlen(key);
+  const typeof(properties[0]) *entry =
+      &properties[UPOWER_PROPERTY_HASH(len, key[0])];
+  if (entry->name == NULL || entry->len != len ||
+      memcmp(entry->name, key, len) != 0)
+    return UPOWER_PROPERTY_UNKNOWN;
+
+  return entry->property;
+}
+
+// Reads a UPower device properties dictionary (a{sv}), as found in
+// Properties.GetAll replies and PropertiesChanged signals, into device.
+// Properties missing from dictionary are left untouched and unknown ones are
+// skipped. It returns a negative errno-style code on error.
+int upower_device_read(sd_bus_message *m, struct upower_device *device) {
+  SDBUS_TRY(sd_bus_message_enter_container(m, 'a', "{sv}"));
+
+  int r;
+  while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+    const char *key;
+    SDBUS_TRY(sd_bus_message_read(m, "s", &key));
+
+    switch (upower_property_lookup(key)) {
+    case UPOWER_PROPERTY_TYPE:
+      SDBUS_TRY(sd_bus_message_read(m, "v", "u", &device->type));
+      break;
+    case UPOWER_PROPERTY_STATE:
+      SDBUS_TRY(sd_bus_message_read(m, "v", "u", &device->state));
+      break;
+    case UPOWER_PROPERTY_BATTERY_LEVEL:
+      SDBUS_TRY(sd_bus_message_read(m, "v", "u", &device->level));
+      break;
+    case UPOWER_PROPERTY_PERCENTAGE:
+      SDBUS_TRY(sd_bus_message_read(m, "v", "d", &device->percentage));
+      break;
+    case UPOWER_PROPERTY_ENERGY_RATE:
+      SDBUS_TRY(sd_bus_message_read(m, "v", "d", &device->energy_rate));
+      break;
+    default:
+      SDBUS_TRY(sd_bus_message_skip(m, "v"));
+      break;
+    }
+
+    SDBUS_TRY(sd_bus_message_exit_container(m));
+  }
+  SDBUS_TRY(r);
+
+  return sd_bus_message_exit_container(m);
+}
+
+// Callback called with path and properties of a UPower battery. device is
+// NULL if device isn't a battery or its properties couldn't be retrieved.
+typedef void (*upower_battery_cb)(sd_bus *bus, const char *path,
+                                  const struct upower_device *device,
+                                  void *data);
+
+// Pending Properties.GetAll call of a UPower device.
+struct upower_get_all {
+  sd_bus *bus;
+  upower_battery_cb cb;
+  void *data;
+  char path[];
+};
+
+static int on_upower_get_all(sd_bus_message *m, void *userdata,
+                             sd_bus_error *ret_error) {
+  (void)ret_error;
+
+  struct upower_get_all *call = userdata;
+  struct upower_device device = {0};
+
+  // Device may be gone since enumeration.
+  const sd_bus_error *error = sd_bus_message_get_error(m);
+  if (error != NULL) {
+    LOG_ERR("failed to get properties of UPower device '%s': %s", call->path,
+            error->message);
+    call->cb(call->bus, call->path, NULL, call->data);
+    return 0;
+  }
+
+  SDBUS_PANIC(upower_device_read(m, &device),
+              "failed to read properties of UPower device");
+
+  if (device.type == UPOWER_DEVICE_BATTERY) {
+    LOG_DBG("UPower device '%s' is a battery", call->path);
+    call->cb(call->bus, call->path, &device, call->data);
+  } else {
+    call->cb(call->bus, call->path, NULL, call->data);
+  }
+
+  return 0;
+}
+
+// Retrieves properties of UPower device at path asynchronously and calls cb
+// with them. Call is owned by slot, unreferencing it before reply arrives
+// cancels call and cb is then never called.
+void upower_get_battery(sd_bus *bus, sd_bus_slot **slot, const char *path,
+                        upower_battery_cb cb, void *data) {
+  size_t len = strlen(path) + 1;
+  struct upower_get_all *call = malloc(sizeof(*call) + len);
+  if (call == NULL)
+    LOG_FATAL("failed to allocate UPower device call");
+  call->bus = bus;
+  call->cb = cb;
+  call->data = data;
+  memcpy(call->path, path, len);
+
+  SDBUS_PANIC(sd_bus_call_method_async(bus, slot, "org.freedesktop.UPower",
+                                       path, "org.freedesktop.DBus.Properties",
+                                       "GetAll", on_upower_get_all, call, "s",
+                                       "org.freedesktop.UPower.Device"),
+              "failed to get properties of UPower device");
+
+  // Call data lives as long as slot, whether call is replied or cancelled.
+  SDBUS_PANIC(sd_bus_slot_set_destroy_callback(*slot, free),
+              "failed to set UPower device call destroy callback");
+}
+
+// Callback called with path of a UPower device.
+typedef void (*upower_device_cb)(sd_bus *bus, const char *path, void *data);
+
+// Watches PropertiesChanged signals of UPower device at path. Match rule
+// filters on interface argument so the bus daemon only wakes us up for
+// org.freedesktop.UPower.Device changes. AddMatch reply isn't waited for.
+void upower_watch_device(sd_bus *bus, sd_bus_slot **slot, const char *path,
+                         sd_bus_message_handler_t cb, void *data) {
+  // Object paths only contain [A-Za-z0-9_/], no escaping is needed.
+  char *match = NULL;
+  ERRNO_PANIC(asprintf(&match,
+                       "type='signal',"
+                       "sender='org.freedesktop.UPower',"
+                       "path='%s',"
+                       "interface='org.freedesktop.DBus.Properties',"
+                       "member='PropertiesChanged',"
+                       "arg0='org.freedesktop.UPower.Device'",
+                       path),
+              "failed to allocate UPower device match rule");
 
-  SDBUS_PANIC(sd_bus_message_enter_container(reply, 'a', "o"),
+  SDBUS_PANIC(sd_bus_add_match_async(bus, slot, match, cb, NULL, data),
+              "failed to watch UPower device for property change");
+  free(match);
+}
+
+// Pending UPower.EnumerateDevices call.
+struct upower_enumerate {
+  upower_device_cb cb;
+  void *data;
+};
+
+static int on_upower_enumerate(sd_bus_message *m, void *userdata,
+                               sd_bus_error *ret_error) {
+  (void)ret_error;
+
+  struct upower_enumerate *call = userdata;
+  sd_bus *bus = sd_bus_message_get_bus(m);
+
+  const sd_bus_error *error = sd_bus_message_get_error(m);
+  if (error != NULL)
+    LOG_FATAL("failed to call UPower method to enumerate devices: %s",
+              error->message);
+
+  SDBUS_PANIC(sd_bus_message_enter_container(m, 'a', "o"),
               "failed to enter UPower.EnumerateDevices array");
 
   const char *path;
-  while (sd_bus_message_read(reply, "o", &path) > 0) {
+  while (sd_bus_message_read(m, "o", &path) > 0) {
     LOG_DBG("UPower device path: %s", path);
 
-    sd_bus_message *type_reply = NULL;
-    uint32_t type = 0;
-    SDBUS_PANIC(sd_bus_get_property(bus, "org.freedesktop.UPower", path,
-                                    "org.freedesktop.UPower.Device", "Type",
-                                    NULL, &type_reply, "u"),
-                "failed to get type of UPower power device");
-    SDBUS_PANIC(sd_bus_message_read(type_reply, "u", &type),
-                "failed to read UPower device 'Type' property");
-
-    if (type == UPOWER_DEVICE_BATTERY) {
-      LOG_DBG("UPower device '%s' is a battery", path);
-      cb(bus, path, data);
-    }
-    sd_bus_message_unref(type_reply);
+    call->cb(bus, path, call->data);
   }
 
-  sd_bus_message_unref(reply);
+  free(call);
+  return 0;
+}
+
+// Enumerates UPower devices asynchronously and calls cb with the path of each
+// device from the event loop bus is attached to. cb is expected to pipeline
+// upower_get_battery() calls: they are all sent before any reply is
+// processed.
+void for_all_devices(sd_bus *bus, void *data, upower_device_cb cb) {
+  struct upower_enumerate *call = malloc(sizeof(*call));
+  if (call == NULL)
+    LOG_FATAL("failed to allocate UPower enumerate call");
+  call->cb = cb;
+  call->data = data;
+
+  SDBUS_PANIC(sd_bus_call_method_async(bus, NULL, "org.freedesktop.UPower",
+                                       "/org/freedesktop/UPower",
+                                       "org.freedesktop.UPower",
+                                       "EnumerateDevices", on_upower_enumerate,
+                                       call, ""),
+              "failed to call UPower method to enumerate devices");
 }
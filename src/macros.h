@@ -213,5 +213,7 @@
 #endif
 
 #define ALEN(v) (sizeof(v) / sizeof((v)[0]))
+#define CONTAINER_OF(ptr, type, member)                                        \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
 
 #endif
@@ -1,71 +1,118 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include <xkbcommon/xkbcommon.h>
+
 #include "sinit.h"
+#include "sinit_draw.h"
 
 #ifndef LOG_MODULE
 #define LOG_MODULE "sinit"
 #endif
 #include "log.h"
+#include "macros.h"
+#include "tllist.h"
 
 #include "stable/presentation-time/presentation-time.h"
+#include "stable/viewporter/viewporter.h"
 #include "stable/xdg-shell/xdg-shell.h"
+#include "staging/cursor-shape/cursor-shape-v1.h"
+#include "staging/fractional-scale/fractional-scale-v1.h"
 #include "wlr/unstable/wlr-layer-shell-unstable-v1.h"
 
-struct sinit_surface_config {
-  int width;
-  int height;
-};
+#define NSEC_PER_SEC 1000000000ull
 
-enum sinit_surface_type {
-  SINIT_RAW_SURFACE,
-  SINIT_XDG_TOP_LEVEL_SURFACE,
-  SINIT_LAYER_SHELL_SURFACE,
-};
+// Frames whose render would be delayed less than that are rendered right
+// away.
+#define FRAME_TIMER_SLACK_NS (100 * 1000)
+
+#define MAX_EPOLL_EVENTS 16
 
-struct sinit_base_surface {
-  enum sinit_surface_type type;
-  struct wl_surface *wl_surface;
-  struct wl_region *region;
-  struct wl_callback *wl_callback;
-  struct wl_buffer *wl_buffer;
-  int factor;
-  void *buffer;
-
-  // Config.
-  struct sinit_surface_config config;
-
-  sinit_render_fn render;
-  uint32_t prev_render;
-  void *userdata;
-  bool closed;
+static const struct {
+  uint32_t shm;
+  int bpp;
+  const char *name;
+} formats[SINIT_FORMAT_COUNT] = {
+    [SINIT_FORMAT_ARGB8888] = {WL_SHM_FORMAT_ARGB8888, 4, "ARGB8888"},
+    [SINIT_FORMAT_XRGB8888] = {WL_SHM_FORMAT_XRGB8888, 4, "XRGB8888"},
+    [SINIT_FORMAT_RGB565] = {WL_SHM_FORMAT_RGB565, 2, "RGB565"},
+    [SINIT_FORMAT_ABGR2101010] = {WL_SHM_FORMAT_ABGR2101010, 4,
+                                  "ABGR2101010"},
 };
 
 /**
- * A window or XDG shell surface in Wayland terms.
+ * Threads executing render jobs. Completed jobs are handed back to the event
+ * loop through an eventfd.
  */
-struct sinit_xdg_toplevel_surface {
-  struct sinit_base_surface base;
-  struct xdg_toplevel *xdg_toplevel;
-  struct xdg_surface *xdg_surface;
-
-  // Config.
-  struct sinit_surface_config pending_config;
+struct render_pool {
+  pthread_t *threads;
+  int n_threads;
+  bool stop;
+
+  // Protects everything below.
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_cond_t done_cond;
+  tll(struct sinit_render_job *) queue;
+  tll(struct sinit_render_job *) done;
+
+  struct sinit_source source;
 };
 
 /**
- * A layer shell surface.
+ * Tiles of a worker or calling thread, other threads steal from the front of
+ * the range once theirs is exhausted.
  */
-struct sinit_layer_surface {
-  struct sinit_base_surface base;
-  struct zwlr_layer_surface_v1 *layer_surface;
+struct tile_queue {
+  _Alignas(64) atomic_int next;
+  int end;
 };
 
 /**
- * A generic surface type.
+ * Threads rendering tiles of a single frame at a time alongside the thread
+ * rendering the frame.
  */
-typedef union sinit_surface {
-  struct sinit_base_surface base;
-  struct sinit_xdg_toplevel_surface xdg;
-  struct sinit_layer_surface layer;
-} sinit_surface;
+struct tile_pool {
+  pthread_t *threads;
+  int n_threads;
+  // One queue per worker plus one for the calling thread.
+  struct tile_queue *queues;
+
+  // Serializes frames rendered by different render threads.
+  pthread_mutex_t batch_lock;
+
+  // Protects everything below.
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_cond_t done_cond;
+  uint64_t generation;
+  int active;
+  // Number of started workers, workers use it as their queue index.
+  int n_started;
+  bool stop;
+  struct sinit_render_job *job;
+};
+
+// Batch of epoll events being dispatched. Entries of sources removed meanwhile
+// are cleared so they aren't dispatched, in this batch and in the batches of
+// outer sinit_dispatch_pending() calls.
+struct dispatch_batch {
+  struct epoll_event *events;
+  int len;
+  struct dispatch_batch *outer;
+};
 
 struct sinit_state {
   // Wayland.
@@ -73,37 +120,59 @@ struct sinit_state {
   struct wl_registry *registry;
   struct wl_compositor *compositor;
   uint32_t compositor_name;
+  struct wl_subcompositor *subcompositor;
+  uint32_t subcompositor_name;
   struct wl_shm *shm;
   uint32_t shm_name;
+  // Bit set of supported enum sinit_format.
+  uint32_t shm_formats;
   struct xdg_wm_base *shell;
   uint32_t shell_name;
   struct wp_presentation *presentation;
   uint32_t presentation_name;
+  clockid_t clock_id;
   struct zwlr_layer_shell_v1 *layer_shell;
   uint32_t layer_shell_name;
+  struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+  uint32_t fractional_scale_manager_name;
+  struct wp_viewporter *viewporter;
+  uint32_t viewporter_name;
+  tll(struct sinit_output *) outputs;
+  const struct sinit_output_listener *output_listener;
+  void *output_listener_data;
+  tll(struct sinit_seat *) seats;
+  tll(sinit_surface *) surfaces;
+  // Some surfaces are lost and must be created again once globals they
+  // depend on are back.
+  bool rebuild;
+  struct wp_cursor_shape_manager_v1 *cursor_shape_manager;
+  uint32_t cursor_shape_manager_name;
+  // Created along with the first keymap.
+  struct xkb_context *xkb_context;
+
+  // Event loop.
+  int epoll_fd;
+  struct sinit_source display_source;
+  // Display source also watches EPOLLOUT, a flush hit a full socket buffer.
+  bool flush_pending;
+  // Innermost batch of events being dispatched by sinit_dispatch_pending().
+  struct dispatch_batch *batch;
+  // wl_display_prepare_read() succeeded and must be followed by a read or a
+  // cancel.
+  bool reading;
+  struct render_pool render_pool;
+  struct tile_pool tile_pool;
 
   // General data.
   const char *app_id;
-};
-
-/**
- * A surface initialization library that provides easy ways to create rendering
- * surfaces (layer shell, XDG shell / window). Current implementation is
- * Wayland only.
- */
-
-union sinit_surface;
-typedef void (*sinit_render_fn)(union sinit_surface *surf, void *buf, int width,
-                                int height, int scale, uint32_t time,
-                                void *userdata);
-
-struct sinit_surface_config {
-  int width;
-  int height;
+  bool hugetlb;
 };
 
 static struct sinit_state state = {0};
 
+// Current thread is a render worker.
+static _Thread_local bool render_worker = false;
+
 /* Wayland boilerplate */
 
 static void xdg_wm_base_ping(void *data, struct xdg_wm_base *shell,
@@ -116,11 +185,190 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
     .ping = &xdg_wm_base_ping,
 };
 
+static void shm_format(void *data, struct wl_shm *shm, uint32_t format) {
+  (void)shm;
+
+  struct sinit_state *state = data;
+  for (int i = 0; i < SINIT_FORMAT_COUNT; i++) {
+    if (formats[i].shm == format) {
+      LOG_DBG("wl_shm supports format %s", formats[i].name);
+      state->shm_formats |= 1u << i;
+    }
+  }
+}
+
+static const struct wl_shm_listener shm_listener = {
+    .format = shm_format,
+};
+
+static void presentation_clock_id(void *data,
+                                  struct wp_presentation *presentation,
+                                  uint32_t clk_id) {
+  (void)presentation;
+
+  struct sinit_state *state = data;
+  LOG_DBG("presentation clock id %d", clk_id);
+  state->clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_clock_id,
+};
+
+static void output_geometry(void *data, struct wl_output *wl_output, int32_t x,
+                            int32_t y, int32_t physical_width,
+                            int32_t physical_height, int32_t subpixel,
+                            const char *make, const char *model,
+                            int32_t transform) {
+  (void)wl_output;
+  (void)physical_width;
+  (void)physical_height;
+  (void)subpixel;
+  (void)make;
+  (void)model;
+  (void)transform;
+
+  struct sinit_output *output = data;
+  output->x = x;
+  output->y = y;
+}
+
+static void output_mode(void *data, struct wl_output *wl_output,
+                        uint32_t flags, int32_t width, int32_t height,
+                        int32_t refresh) {
+  (void)wl_output;
+
+  struct sinit_output *output = data;
+  if ((flags & WL_OUTPUT_MODE_CURRENT) == 0)
+    return;
+
+  output->width = width;
+  output->height = height;
+  output->refresh = refresh;
+}
+
+static void output_done(void *data, struct wl_output *wl_output) {
+  (void)wl_output;
+
+  struct sinit_output *output = data;
+  const struct sinit_output_listener *listener = state.output_listener;
+
+  LOG_DBG("output %s done x=%d y=%d width=%d height=%d refresh=%d scale=%d",
+          output->name != NULL ? output->name : "?", output->x, output->y,
+          output->width, output->height, output->refresh, output->scale);
+
+  if (!output->ready) {
+    output->ready = true;
+    if (listener != NULL && listener->added != NULL)
+      listener->added(output, state.output_listener_data);
+  } else if (listener != NULL && listener->changed != NULL) {
+    listener->changed(output, state.output_listener_data);
+  }
+}
+
+static void output_scale(void *data, struct wl_output *wl_output,
+                         int32_t factor) {
+  (void)wl_output;
+
+  struct sinit_output *output = data;
+  output->scale = factor;
+}
+
+static void output_name(void *data, struct wl_output *wl_output,
+                        const char *name) {
+  (void)wl_output;
+
+  struct sinit_output *output = data;
+  free(output->name);
+  output->name = strdup(name);
+}
+
+static void output_description(void *data, struct wl_output *wl_output,
+                               const char *description) {
+  (void)wl_output;
+
+  struct sinit_output *output = data;
+  free(output->description);
+  output->description = strdup(description);
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+    .name = output_name,
+    .description = output_description,
+};
+
+static void output_add(struct sinit_state *state, struct wl_registry *registry,
+                       uint32_t name, uint32_t version) {
+  struct sinit_output *output = calloc(1, sizeof(*output));
+  if (output == NULL)
+    LOG_FATAL("failed to allocate output");
+
+  output->global = name;
+  output->scale = 1;
+  output->wl_output = wl_registry_bind(registry, name, &wl_output_interface,
+                                       version < 4 ? version : 4);
+  wl_output_add_listener(output->wl_output, &output_listener, output);
+  tll_push_back(state->outputs, output);
+}
+
+static void output_destroy(struct sinit_output *output) {
+  if (wl_proxy_get_version((struct wl_proxy *)output->wl_output) >=
+      WL_OUTPUT_RELEASE_SINCE_VERSION)
+    wl_output_release(output->wl_output);
+  else
+    wl_output_destroy(output->wl_output);
+  free(output->name);
+  free(output->description);
+  free(output);
+}
+
+// Removes output with the given global name. Returns false if there is none.
+static bool output_remove(struct sinit_state *state, uint32_t name) {
+  tll_foreach(state->outputs, it) {
+    struct sinit_output *output = it->item;
+    if (output->global != name)
+      continue;
+
+    LOG_DBG("output %s removed", output->name != NULL ? output->name : "?");
+
+    const struct sinit_output_listener *listener = state->output_listener;
+    if (output->ready && listener != NULL && listener->removed != NULL)
+      listener->removed(output, state->output_listener_data);
+
+    // Rebuilt layer surfaces let compositor pick an output.
+    tll_foreach(state->surfaces, s) {
+      sinit_surface *surf = s->item;
+      if (surf->base.type == SINIT_LAYER_SHELL_SURFACE &&
+          surf->layer.output == output)
+        surf->layer.output = NULL;
+    }
+
+    output_destroy(output);
+    tll_remove(state->outputs, it);
+    return true;
+  }
+
+  return false;
+}
+
+static void seat_add(struct sinit_state *state, struct wl_registry *registry,
+                     uint32_t name, uint32_t version);
+static void seat_destroy(struct sinit_seat *seat);
+static bool seat_remove(struct sinit_state *state, uint32_t name);
+static void seats_sync_cursor_shape(struct sinit_state *state);
+static void surfaces_destroy(enum sinit_surface_type type);
+static void surfaces_drop_fractional_scale(void);
+static void surfaces_rebuild(void);
+static void
+frame_scheduler_drop_feedbacks(struct sinit_frame_scheduler *sched);
+
 static void handle_global(void *data, struct wl_registry *registry,
                           uint32_t name, const char *interface,
                           uint32_t version) {
-  (void)version;
-
   LOG_DBG("wayland global %d added", name);
 
   struct sinit_state *state = data;
@@ -129,21 +377,57 @@ static void handle_global(void *data, struct wl_registry *registry,
     state->compositor =
         wl_registry_bind(registry, name, &wl_compositor_interface, 6);
     state->compositor_name = name;
+    state->rebuild = true;
+  } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+    state->subcompositor =
+        wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
+    state->subcompositor_name = name;
+    state->rebuild = true;
   } else if (strcmp(interface, wl_shm_interface.name) == 0) {
     state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    wl_shm_add_listener(state->shm, &shm_listener, state);
     state->shm_name = name;
+    // Always supported.
+    state->shm_formats =
+        1u << SINIT_FORMAT_ARGB8888 | 1u << SINIT_FORMAT_XRGB8888;
+    state->rebuild = true;
   } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
-    state->shell = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+    // Version 6 adds suspended toplevel state.
+    state->shell = wl_registry_bind(registry, name, &xdg_wm_base_interface,
+                                    version < 6 ? version : 6);
     xdg_wm_base_add_listener(state->shell, &xdg_wm_base_listener, state);
     state->shell_name = name;
+    state->rebuild = true;
   } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
     state->presentation =
         wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+    wp_presentation_add_listener(state->presentation, &presentation_listener,
+                                 state);
     state->presentation_name = name;
   } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
     state->layer_shell =
         wl_registry_bind(registry, name, &zwlr_layer_shell_v1_interface, 1);
     state->layer_shell_name = name;
+    state->rebuild = true;
+  } else if (strcmp(interface,
+                    wp_fractional_scale_manager_v1_interface.name) == 0) {
+    state->fractional_scale_manager = wl_registry_bind(
+        registry, name, &wp_fractional_scale_manager_v1_interface, 1);
+    state->fractional_scale_manager_name = name;
+  } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+    state->viewporter =
+        wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    state->viewporter_name = name;
+  } else if (strcmp(interface,
+                    wp_cursor_shape_manager_v1_interface.name) == 0) {
+    state->cursor_shape_manager = wl_registry_bind(
+        registry, name, &wp_cursor_shape_manager_v1_interface, 1);
+    state->cursor_shape_manager_name = name;
+    seats_sync_cursor_shape(state);
+  } else if (strcmp(interface, wl_output_interface.name) == 0) {
+    output_add(state, registry, name, version);
+  } else if (strcmp(interface, wl_seat_interface.name) == 0) {
+    seat_add(state, registry, name, version);
   }
 }
 
@@ -152,16 +436,72 @@ static void handle_global_remove(void *data, struct wl_registry *registry,
   (void)registry;
 
   struct sinit_state *state = data;
+  // Surfaces depending on a removed global are destroyed and rebuilt in place
+  // once it is advertised again.
   if (name == state->compositor_name) {
-    LOG_FATAL("global wayland compositor removed");
+    LOG_WARN("global wayland compositor removed");
+    surfaces_destroy(SINIT_RAW_SURFACE);
+    wl_compositor_destroy(state->compositor);
+    state->compositor = NULL;
+    state->compositor_name = 0;
+  } else if (name == state->subcompositor_name) {
+    LOG_WARN("global wayland subcompositor removed");
+    surfaces_destroy(SINIT_SUBSURFACE);
+    wl_subcompositor_destroy(state->subcompositor);
+    state->subcompositor = NULL;
+    state->subcompositor_name = 0;
   } else if (name == state->shm_name) {
-    LOG_FATAL("global wayland shm removed");
+    LOG_WARN("global wayland shm removed");
+    surfaces_destroy(SINIT_RAW_SURFACE);
+    wl_shm_destroy(state->shm);
+    state->shm = NULL;
+    state->shm_name = 0;
   } else if (name == state->shell_name) {
-    LOG_FATAL("global wayland shell removed");
-  } else if (name == state->presentation_name) {
-    LOG_FATAL("global wayland presentation removed");
+    LOG_WARN("global wayland shell removed");
+    // Shell can't be destroyed before its surfaces.
+    surfaces_destroy(SINIT_XDG_TOP_LEVEL_SURFACE);
+    xdg_wm_base_destroy(state->shell);
+    state->shell = NULL;
+    state->shell_name = 0;
   } else if (name == state->layer_shell_name) {
-    LOG_FATAL("global wayland layer shell removed");
+    LOG_WARN("global wayland layer shell removed");
+    surfaces_destroy(SINIT_LAYER_SHELL_SURFACE);
+    zwlr_layer_shell_v1_destroy(state->layer_shell);
+    state->layer_shell = NULL;
+    state->layer_shell_name = 0;
+  } else if (name == state->fractional_scale_manager_name ||
+             name == state->viewporter_name) {
+    LOG_WARN("global wayland scaling protocol removed");
+    // Surfaces fall back to integer scales.
+    surfaces_drop_fractional_scale();
+    if (name == state->viewporter_name) {
+      wp_viewporter_destroy(state->viewporter);
+      state->viewporter = NULL;
+      state->viewporter_name = 0;
+    } else {
+      wp_fractional_scale_manager_v1_destroy(state->fractional_scale_manager);
+      state->fractional_scale_manager = NULL;
+      state->fractional_scale_manager_name = 0;
+    }
+  } else if (name == state->presentation_name) {
+    LOG_WARN("global wayland presentation removed");
+    tll_foreach(state->surfaces, it) {
+      frame_scheduler_drop_feedbacks(&it->item->base.scheduler);
+    }
+    wp_presentation_destroy(state->presentation);
+    state->presentation = NULL;
+    state->presentation_name = 0;
+  } else if (name == state->cursor_shape_manager_name) {
+    LOG_DBG("global wayland cursor shape manager removed");
+    struct wp_cursor_shape_manager_v1 *manager = state->cursor_shape_manager;
+    state->cursor_shape_manager = NULL;
+    state->cursor_shape_manager_name = 0;
+    seats_sync_cursor_shape(state);
+    wp_cursor_shape_manager_v1_destroy(manager);
+  } else if (output_remove(state, name)) {
+    return;
+  } else if (seat_remove(state, name)) {
+    return;
   } else {
     LOG_DBG("global %d removed", name);
   }
@@ -172,21 +512,40 @@ static const struct wl_registry_listener registry_listener = {
     .global_remove = handle_global_remove,
 };
 
-static void create_wl_buffer(struct wl_shm *shm, int width, int height,
-                             struct wl_buffer **wl_buf, void **buf);
 static void resize_surface(sinit_surface *surf, int width, int height,
-                           int factor);
-static void sinit_surface_request_frame(sinit_surface *surf);
+                           uint32_t scale);
 static void sinit_surface_render(sinit_surface *surf, uint32_t time);
-static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
-                                  uint32_t serial) {
-  (void)xdg_surface;
+static void surface_commit(sinit_surface *surf);
+static void surface_frame(sinit_surface *surf);
+static void frame_scheduler_schedule(struct sinit_frame_scheduler *sched,
+                                     uint32_t time);
 
-  sinit_surface *surf = data;
+static bool surface_hidden(sinit_surface *surf) {
+  return surf->base.lost || surf->base.offscreen || surf->base.suspended;
+}
 
-  LOG_DBG("xdg surface configure serial=%d", serial);
+// Requests frame delayed while surface was hidden.
+static void surface_show(sinit_surface *surf) {
+  if (surf->base.dirty && !surface_hidden(surf))
+    sinit_surface_request_frame(surf);
+}
+
+// Renders first frame or schedules a new one after a configure event.
+static void surface_configured(sinit_surface *surf, bool resized) {
+  if (surf->base.prev_render == 0)
+    sinit_surface_render(surf, 0);
+  else if (resized || !surf->base.on_demand)
+    sinit_surface_request_frame(surf);
+  else if (!surf->base.job.in_flight)
+    // Apply acked configure without rendering.
+    surface_commit(surf);
+}
 
-  xdg_surface_ack_configure(surf->xdg.xdg_surface, serial);
+// Acks latest configure event and applies it. It returns whether surface was
+// resized.
+static bool xdg_surface_apply_configure(sinit_surface *surf) {
+  surf->xdg.configure_pending = false;
+  xdg_surface_ack_configure(surf->xdg.xdg_surface, surf->xdg.configure_serial);
 
   bool resized = surf->base.config.width != surf->xdg.pending_config.width ||
                  surf->base.config.height != surf->xdg.pending_config.height;
@@ -198,26 +557,53 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
     LOG_DBG("surface resized from w=%d h=%d to w=%d h=%d",
             surf->base.config.width, surf->base.config.height, width, height);
 
-    // Resize buffer.
-    resize_surface(surf, surf->xdg.pending_config.width,
-                   surf->xdg.pending_config.height, surf->base.factor);
-
-    // Update opaque region.
-    if (surf->base.region != NULL) {
-      wl_region_subtract(surf->base.region, 0, 0, surf->base.config.width,
-                         surf->base.config.height);
-      wl_region_add(surf->base.region, 0, 0, width, height);
-      wl_surface_set_opaque_region(surf->base.wl_surface, surf->base.region);
-    }
+    // Resize buffer, opaque region follows on next commit.
+    resize_surface(surf, width, height, surf->base.scale);
   }
 
   surf->base.config = surf->xdg.pending_config;
 
-  // Render first frame or schedule a new frame.
-  if (surf->base.prev_render == 0)
-    sinit_surface_render(surf, 0);
-  else
-    sinit_surface_request_frame(surf);
+  bool resumed = surf->base.suspended && !surf->xdg.pending_suspended;
+  surf->base.suspended = surf->xdg.pending_suspended;
+  if (resumed)
+    surface_show(surf);
+
+  return resized;
+}
+
+// Applies configure events received since last frame. It returns whether
+// there was one.
+static bool surface_flush_configure(sinit_surface *surf) {
+  if (surf->base.type != SINIT_XDG_TOP_LEVEL_SURFACE ||
+      !surf->xdg.configure_pending)
+    return false;
+
+  if (xdg_surface_apply_configure(surf) || !surf->base.on_demand)
+    surf->base.dirty = true;
+  return true;
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+                                  uint32_t serial) {
+  (void)xdg_surface;
+
+  sinit_surface *surf = data;
+
+  LOG_DBG("xdg surface configure serial=%d", serial);
+
+  surf->xdg.configure_serial = serial;
+  surf->xdg.configure_pending = true;
+
+  // Configure events, dozens per frame during interactive resizes, are
+  // coalesced until next frame. First one maps surface and hidden surfaces
+  // may not get frames, they are applied right away.
+  if (surf->base.prev_render != 0 && !surface_hidden(surf)) {
+    if (!surf->base.scheduler.armed)
+      surface_frame(surf);
+    return;
+  }
+
+  surface_configured(surf, xdg_surface_apply_configure(surf));
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -229,7 +615,6 @@ static void xdg_toplevel_configure(void *data,
                                    int32_t width, int32_t height,
                                    struct wl_array *states) {
   (void)xdg_toplevel;
-  (void)states;
 
   sinit_surface *surf = data;
 
@@ -240,6 +625,13 @@ static void xdg_toplevel_configure(void *data,
     surf->xdg.pending_config.width = width;
   if (height > 0)
     surf->xdg.pending_config.height = height;
+
+  surf->xdg.pending_suspended = false;
+  uint32_t *s;
+  wl_array_for_each(s, states) {
+    if (*s == XDG_TOPLEVEL_STATE_SUSPENDED)
+      surf->xdg.pending_suspended = true;
+  }
 }
 
 static void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
@@ -283,13 +675,22 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 
 static void frame_done(void *data, struct wl_callback *callback,
                        uint32_t time) {
-  (void)time;
   sinit_surface *surf = data;
 
   wl_callback_destroy(callback);
   surf->base.wl_callback = NULL;
 
-  sinit_surface_render(surf, time);
+  bool configured = surface_flush_configure(surf);
+
+  // Surface is up to date or hidden, frame is requested again once it is
+  // shown.
+  if (!surf->base.dirty || surface_hidden(surf)) {
+    if (configured && !surf->base.job.in_flight)
+      surface_commit(surf);
+    return;
+  }
+
+  frame_scheduler_schedule(&surf->base.scheduler, time);
 }
 
 static const struct wl_callback_listener frame_listener = {
@@ -320,13 +721,9 @@ static void layer_surface_configure(void *data,
 
   if (resized || surf->base.prev_render == 0)
     resize_surface(surf, surf->layer.base.config.width,
-                   surf->layer.base.config.height, surf->base.factor);
+                   surf->layer.base.config.height, surf->base.scale);
 
-  // Render first frame or schedule a new frame.
-  if (surf->base.prev_render == 0) {
-    sinit_surface_render(surf, 0);
-  } else
-    sinit_surface_request_frame(surf);
+  surface_configured(surf, resized);
 }
 
 static void layer_surface_closed(void *data,
@@ -343,16 +740,40 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
 
 static void surface_enter(void *data, struct wl_surface *wl_surface,
                           struct wl_output *output) {
-  (void)data;
   (void)wl_surface;
   (void)output;
+
+  sinit_surface *surf = data;
+  surf->base.n_outputs++;
+  if (surf->base.offscreen) {
+    surf->base.offscreen = false;
+    surface_show(surf);
+  }
 }
 
 static void surface_leave(void *data, struct wl_surface *wl_surface,
                           struct wl_output *output) {
-  (void)data;
   (void)wl_surface;
   (void)output;
+
+  sinit_surface *surf = data;
+  if (surf->base.n_outputs > 0)
+    surf->base.n_outputs--;
+  if (surf->base.n_outputs == 0) {
+    LOG_DBG("surface %p left all outputs", (void *)surf);
+    surf->base.offscreen = true;
+  }
+}
+
+static void surface_set_scale(sinit_surface *surf, uint32_t scale) {
+  bool changed = surf->base.scale != scale;
+  if (changed && surf->base.prev_render != 0)
+    resize_surface(surf, surf->base.config.width, surf->base.config.height,
+                   scale);
+
+  surf->base.scale = scale;
+  if (changed || !surf->base.on_demand)
+    sinit_surface_request_frame(surf);
 }
 
 static void surface_scale(void *data, struct wl_surface *surface,
@@ -363,8 +784,11 @@ static void surface_scale(void *data, struct wl_surface *surface,
 
   LOG_DBG("surface scale surface=%p factor=%d", (void *)surf, factor);
 
-  surf->base.factor = factor;
-  sinit_surface_request_frame(surf);
+  // Fractional scale takes precedence.
+  if (surf->base.fractional_scale != NULL)
+    return;
+
+  surface_set_scale(surf, factor * SINIT_SCALE_DENOMINATOR);
 }
 
 static void surface_buffer_transform(void *data, struct wl_surface *wl_surface,
@@ -381,269 +805,2953 @@ static const struct wl_surface_listener surface_listener = {
     .preferred_buffer_transform = surface_buffer_transform,
 };
 
-/* Private helper function */
-
-static int create_shm_file(size_t size) {
-  char template[] = "/tmp/wayland-shm-XXXXXX";
-  int fd = mkstemp(template);
-  if (fd < 0)
-    return -1;
+static void fractional_scale_preferred_scale(
+    void *data, struct wp_fractional_scale_v1 *fractional_scale,
+    uint32_t scale) {
+  (void)fractional_scale;
 
-  unlink(template);
+  sinit_surface *surf = data;
 
-  if (ftruncate(fd, size) < 0) {
-    close(fd);
-    return -1;
-  }
+  LOG_DBG("surface fractional scale surface=%p scale=%d/%d", (void *)surf,
+          scale, SINIT_SCALE_DENOMINATOR);
 
-  return fd;
+  surface_set_scale(surf, scale);
 }
 
-static void create_wl_buffer(struct wl_shm *shm, int width, int height,
-                             struct wl_buffer **wl_buf, void **buf) {
-  int stride = 4 * width;
-  int size = stride * height;
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener =
+    {
+        .preferred_scale = fractional_scale_preferred_scale,
+};
 
-  int fd = create_shm_file(size);
-  if (fd < 0)
-    LOG_FATAL("failed to create shm file: %m (size=%d)", size);
+/* Seats */
 
-  // Map memory
-  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (data == MAP_FAILED) {
-    close(fd);
-    LOG_FATAL("failed to mmap file: %m (size=%d)", size);
-  }
+/**
+ * Input events of a pointer or touch frame waiting to be delivered, along
+ * with the surface each of them targets.
+ */
+struct input_batch {
+  struct sinit_input_event events[SINIT_INPUT_BATCH_LEN];
+  sinit_surface *surfaces[SINIT_INPUT_BATCH_LEN];
+  int n;
+};
 
-  struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-  struct wl_buffer *buffer = wl_shm_pool_create_buffer(
-      pool, 0, width, height, stride, WL_SHM_FORMAT_ARGB8888);
-  wl_shm_pool_destroy(pool);
+struct touch_point {
+  int32_t id;
+  // NULL if slot is free.
+  sinit_surface *surface;
+};
 
-  close(fd);
+// Modifiers reported in input events, indexed by bit of enum sinit_modifier.
+static const char *const modifier_names[] = {
+    XKB_MOD_NAME_SHIFT, XKB_MOD_NAME_CTRL, XKB_MOD_NAME_ALT,
+    XKB_MOD_NAME_LOGO,  XKB_MOD_NAME_CAPS, XKB_MOD_NAME_NUM,
+};
 
-  *buf = data;
-  *wl_buf = buffer;
-}
+/**
+ * A wl_seat and its input devices. Everything needed to decode and batch
+ * events is allocated along with the seat.
+ */
+struct sinit_seat {
+  struct wl_seat *wl_seat;
+  uint32_t global;
+
+  struct wl_pointer *pointer;
+  struct wp_cursor_shape_device_v1 *cursor_shape;
+  // Pointer sends frame events, events are delivered right away otherwise.
+  bool pointer_frames;
+  sinit_surface *pointer_focus;
+  uint32_t pointer_serial;
+  struct input_batch pointer_events;
+
+  struct wl_keyboard *keyboard;
+  sinit_surface *keyboard_focus;
+  struct xkb_keymap *keymap;
+  struct xkb_state *xkb_state;
+  xkb_mod_index_t mod_indices[ALEN(modifier_names)];
+  uint32_t modifiers;
+
+  struct wl_touch *touch;
+  struct touch_point touch_points[SINIT_TOUCH_POINTS];
+  struct input_batch touch_events;
+};
 
-static void resize_surface(sinit_surface *surf, int width, int height,
-                           int factor) {
-  if (surf->base.wl_buffer != NULL) {
-    wl_buffer_destroy(surf->base.wl_buffer);
-    munmap(surf->base.buffer, surf->base.factor * surf->base.config.width *
-                                  surf->base.config.height * 4);
-  }
-  create_wl_buffer(state.shm, width * factor, height * factor,
-                   &surf->base.wl_buffer, &surf->base.buffer);
-  wl_surface_attach(surf->base.wl_surface, surf->base.wl_buffer, 0, 0);
-  wl_surface_set_buffer_scale(surf->base.wl_surface, factor);
+static const uint32_t cursor_shapes[SINIT_CURSOR_COUNT] = {
+    [SINIT_CURSOR_DEFAULT] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT,
+    [SINIT_CURSOR_POINTER] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_POINTER,
+    [SINIT_CURSOR_TEXT] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_TEXT,
+    [SINIT_CURSOR_CROSSHAIR] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR,
+    [SINIT_CURSOR_WAIT] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_WAIT,
+    [SINIT_CURSOR_GRAB] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRAB,
+    [SINIT_CURSOR_GRABBING] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRABBING,
+    [SINIT_CURSOR_NOT_ALLOWED] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NOT_ALLOWED,
+    [SINIT_CURSOR_EW_RESIZE] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_EW_RESIZE,
+    [SINIT_CURSOR_NS_RESIZE] = WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NS_RESIZE,
+};
+
+// Returns sinit surface of wl_surface or NULL if it isn't one.
+static sinit_surface *surface_from_wl(struct wl_surface *wl_surface) {
+  if (wl_surface == NULL ||
+      wl_proxy_get_listener((struct wl_proxy *)wl_surface) != &surface_listener)
+    return NULL;
+  return wl_surface_get_user_data(wl_surface);
 }
 
-static void init_wayland(struct sinit_state *s) {
-  s->display = wl_display_connect(NULL);
-  if (s->display == NULL)
-    LOG_FATAL("failed to connect to wayland display");
+static void input_deliver(sinit_surface *surf,
+                          const struct sinit_input_event *events, int n) {
+  if (surf->base.input != NULL)
+    surf->base.input(surf, events, n, surf->base.userdata);
+}
 
-  s->registry = wl_display_get_registry(s->display);
-  if (s->display == NULL)
-    LOG_FATAL("failed to get wayland registry");
+// Delivers batched events, consecutive events targeting the same surface are
+// delivered at once. Surfaces deinitialized by an input function are
+// cleared from the batch while it is delivered.
+static void input_batch_flush(struct input_batch *batch) {
+  int i = 0;
+  while (i < batch->n) {
+    sinit_surface *surf = batch->surfaces[i];
+    int end = i + 1;
+    while (end < batch->n && batch->surfaces[end] == surf)
+      end++;
+
+    if (surf != NULL)
+      input_deliver(surf, &batch->events[i], end - i);
+    i = end;
+  }
+  batch->n = 0;
+}
 
-  wl_registry_add_listener(s->registry, &registry_listener, s);
-  if (wl_display_roundtrip(s->display) < 0)
-    LOG_FATAL("wl_display_roundtrip() failed");
+// Appends a zeroed event to batch and returns it, batch is flushed first if
+// it is full.
+static struct sinit_input_event *input_batch_push(struct input_batch *batch,
+                                                  sinit_surface *surf,
+                                                  enum sinit_input_type type) {
+  if (batch->n == SINIT_INPUT_BATCH_LEN)
+    input_batch_flush(batch);
+
+  struct sinit_input_event *event = &batch->events[batch->n];
+  *event = (struct sinit_input_event){.type = type};
+  batch->surfaces[batch->n++] = surf;
+  return event;
+}
 
-  if (s->compositor == NULL)
-    LOG_FATAL("wl_compositor is missing");
-  if (s->shell == NULL)
-    LOG_FATAL("no XDG shell interface");
-  if (s->shm == NULL)
-    LOG_FATAL("compositor doesn't support wl_shm");
-  if (s->presentation == NULL)
-    LOG_FATAL("compositor doesn't support presentation time protocol");
-  if (s->layer_shell == NULL)
-    LOG_FATAL("compositor doesn't support wlr layer shell protocol");
+// Returns last batched event if it targets surf and has the given type.
+static struct sinit_input_event *input_batch_last(struct input_batch *batch,
+                                                  sinit_surface *surf,
+                                                  enum sinit_input_type type) {
+  if (batch->n == 0 || batch->surfaces[batch->n - 1] != surf ||
+      batch->events[batch->n - 1].type != type)
+    return NULL;
+  return &batch->events[batch->n - 1];
 }
 
-static void deinit_wayland(struct sinit_state *s) {
-  zwlr_layer_shell_v1_destroy(s->layer_shell);
-  xdg_wm_base_destroy(s->shell);
-  wl_shm_destroy(s->shm);
-  wl_registry_destroy(s->registry);
-  wl_compositor_destroy(s->compositor);
-  wl_display_disconnect(s->display);
+static void input_batch_forget(struct input_batch *batch, sinit_surface *surf) {
+  for (int i = 0; i < batch->n; i++)
+    if (batch->surfaces[i] == surf)
+      batch->surfaces[i] = NULL;
 }
 
-/* Surface initialization public API */
+static void seat_set_cursor(struct sinit_seat *seat) {
+  if (seat->cursor_shape == NULL || seat->pointer_focus == NULL)
+    return;
 
-/**
- * Initialize library state and connect to display server. This function panics
- * if it failed to do so.
- */
-void sinit_init(const char *app_id) {
-  state.app_id = app_id;
-  init_wayland(&state);
+  wp_cursor_shape_device_v1_set_shape(
+      seat->cursor_shape, seat->pointer_serial,
+      cursor_shapes[seat->pointer_focus->base.cursor]);
 }
 
-/**
- * Process all incoming events and returns a non-negative integer on success and
- * -1 on error.
- */
-int sinit_run() { return wl_display_dispatch(state.display); }
-
-/**
- * Returns file descriptor to poll on to detect new event.
- */
-int sinit_fd() { return wl_display_get_fd(state.display); }
+// Delivers pointer events right away if pointer doesn't send frame events.
+static void pointer_event_done(struct sinit_seat *seat) {
+  if (!seat->pointer_frames)
+    input_batch_flush(&seat->pointer_events);
+}
 
-/**
- * Deinitialize library state and free associated resources.
- */
-void sinit_deinit() { deinit_wayland(&state); }
+static void pointer_enter(void *data, struct wl_pointer *wl_pointer,
+                          uint32_t serial, struct wl_surface *surface,
+                          wl_fixed_t x, wl_fixed_t y) {
+  (void)wl_pointer;
 
-/* Surface methods */
+  struct sinit_seat *seat = data;
+  seat->pointer_focus = surface_from_wl(surface);
+  seat->pointer_serial = serial;
+  if (seat->pointer_focus == NULL)
+    return;
 
-bool sinit_surface_closed(sinit_surface *surf) { return surf->base.closed; }
+  seat_set_cursor(seat);
 
-void sinit_surface_request_frame(sinit_surface *surf) {
-  if (surf->base.wl_callback == NULL) {
-    surf->base.wl_callback = wl_surface_frame(surf->base.wl_surface);
-    wl_callback_add_listener(surf->base.wl_callback, &frame_listener, surf);
-  }
+  struct sinit_input_event *event = input_batch_push(
+      &seat->pointer_events, seat->pointer_focus, SINIT_POINTER_ENTER);
+  event->x = wl_fixed_to_double(x);
+  event->y = wl_fixed_to_double(y);
+  pointer_event_done(seat);
 }
 
-static void sinit_surface_render(sinit_surface *surf, uint32_t time) {
-  if (surf->base.closed)
+static void pointer_leave(void *data, struct wl_pointer *wl_pointer,
+                          uint32_t serial, struct wl_surface *surface) {
+  (void)wl_pointer;
+  (void)serial;
+  (void)surface;
+
+  struct sinit_seat *seat = data;
+  if (seat->pointer_focus == NULL)
     return;
 
-  surf->base.render(surf, surf->base.buffer, surf->base.config.width,
-                    surf->base.config.height, surf->base.factor, time,
-                    surf->base.userdata);
+  input_batch_push(&seat->pointer_events, seat->pointer_focus,
+                   SINIT_POINTER_LEAVE);
+  seat->pointer_focus = NULL;
+  pointer_event_done(seat);
+}
 
-  wl_surface_commit(surf->base.wl_surface);
+static void pointer_motion(void *data, struct wl_pointer *wl_pointer,
+                           uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+  (void)wl_pointer;
 
-  surf->base.prev_render = time;
+  struct sinit_seat *seat = data;
+  if (seat->pointer_focus == NULL)
+    return;
+
+  // Only the last position of a frame matters.
+  struct sinit_input_event *event = input_batch_last(
+      &seat->pointer_events, seat->pointer_focus, SINIT_POINTER_MOTION);
+  if (event == NULL)
+    event = input_batch_push(&seat->pointer_events, seat->pointer_focus,
+                             SINIT_POINTER_MOTION);
+  event->time = time;
+  event->x = wl_fixed_to_double(x);
+  event->y = wl_fixed_to_double(y);
+  pointer_event_done(seat);
 }
 
-/* XDG Shell surface methods */
+static void pointer_button(void *data, struct wl_pointer *wl_pointer,
+                           uint32_t serial, uint32_t time, uint32_t button,
+                           uint32_t button_state) {
+  (void)wl_pointer;
+  (void)serial;
 
-void sinit_xdg_surface_init(sinit_surface *surf, int width, int height,
-                            bool opaque, sinit_render_fn render,
-                            void *userdata) {
-  surf->base.type = SINIT_XDG_TOP_LEVEL_SURFACE;
-  surf->base.factor = 1;
-  surf->base.render = render;
-  surf->base.userdata = userdata;
-  surf->base.closed = false;
-  surf->xdg.pending_config.width = width;
-  surf->xdg.pending_config.height = height;
+  struct sinit_seat *seat = data;
+  if (seat->pointer_focus == NULL)
+    return;
 
-  // Wayland surface
-  surf->base.wl_surface = wl_compositor_create_surface(state.compositor);
-  wl_surface_add_listener(surf->base.wl_surface, &surface_listener, surf);
-  surf->xdg.xdg_surface =
-      xdg_wm_base_get_xdg_surface(state.shell, surf->base.wl_surface);
-  xdg_surface_add_listener(surf->xdg.xdg_surface, &xdg_surface_listener, surf);
-  surf->xdg.xdg_toplevel = xdg_surface_get_toplevel(surf->xdg.xdg_surface);
-  xdg_toplevel_add_listener(surf->xdg.xdg_toplevel, &xdg_toplevel_listener,
-                            surf);
+  struct sinit_input_event *event = input_batch_push(
+      &seat->pointer_events, seat->pointer_focus, SINIT_POINTER_BUTTON);
+  event->time = time;
+  event->code = button;
+  event->pressed = button_state == WL_POINTER_BUTTON_STATE_PRESSED;
+  pointer_event_done(seat);
+}
 
-  xdg_toplevel_set_app_id(surf->xdg.xdg_toplevel, state.app_id);
+// Returns scroll event of current frame, creating it if needed.
+static struct sinit_input_event *pointer_scroll(struct sinit_seat *seat) {
+  struct sinit_input_event *event = input_batch_last(
+      &seat->pointer_events, seat->pointer_focus, SINIT_POINTER_SCROLL);
+  if (event == NULL)
+    event = input_batch_push(&seat->pointer_events, seat->pointer_focus,
+                             SINIT_POINTER_SCROLL);
+  return event;
+}
 
-  // Wayland region.
-  if (opaque) {
-    surf->base.region = wl_compositor_create_region(state.compositor);
-    wl_region_add(surf->base.region, 0, 0, width, height);
-    wl_surface_set_opaque_region(surf->base.wl_surface, surf->base.region);
-  }
+static void pointer_axis(void *data, struct wl_pointer *wl_pointer,
+                         uint32_t time, uint32_t axis, wl_fixed_t value) {
+  (void)wl_pointer;
 
-  // Commit surface.
-  wl_surface_commit(surf->base.wl_surface);
+  struct sinit_seat *seat = data;
+  if (seat->pointer_focus == NULL)
+    return;
+
+  struct sinit_input_event *event = pointer_scroll(seat);
+  event->time = time;
+  if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+    event->scroll_y += wl_fixed_to_double(value);
+  else
+    event->scroll_x += wl_fixed_to_double(value);
+  pointer_event_done(seat);
 }
 
-void sinit_xdg_toplevel_surface_deinit(sinit_surface *surf) {
-  // Destroy Wayland resources.
-  if (surf->base.wl_callback != NULL)
-    wl_callback_destroy(surf->base.wl_callback);
-  if (surf->base.wl_buffer != NULL) {
-    wl_buffer_destroy(surf->base.wl_buffer);
-    munmap(surf->base.buffer,
-           surf->base.config.width * surf->base.config.height * 4);
-  }
-  if (surf->xdg.xdg_toplevel != NULL)
-    xdg_toplevel_destroy(surf->xdg.xdg_toplevel);
-  if (surf->xdg.xdg_surface != NULL)
-    xdg_surface_destroy(surf->xdg.xdg_surface);
-  if (surf->base.region != NULL)
-    wl_region_destroy(surf->base.region);
-  if (surf->base.wl_surface != NULL)
-    wl_surface_destroy(surf->base.wl_surface);
+static void pointer_frame(void *data, struct wl_pointer *wl_pointer) {
+  (void)wl_pointer;
 
-  surf->base.type = SINIT_RAW_SURFACE;
+  struct sinit_seat *seat = data;
+  input_batch_flush(&seat->pointer_events);
 }
 
-/* Layer shell surface */
+static void pointer_axis_source(void *data, struct wl_pointer *wl_pointer,
+                                uint32_t axis_source) {
+  (void)data;
+  (void)wl_pointer;
+  (void)axis_source;
+}
+
+static void pointer_axis_stop(void *data, struct wl_pointer *wl_pointer,
+                              uint32_t time, uint32_t axis) {
+  (void)data;
+  (void)wl_pointer;
+  (void)time;
+  (void)axis;
+}
+
+static void pointer_axis_value120(void *data, struct wl_pointer *wl_pointer,
+                                  uint32_t axis, int32_t value120) {
+  (void)wl_pointer;
+
+  struct sinit_seat *seat = data;
+  if (seat->pointer_focus == NULL)
+    return;
+
+  struct sinit_input_event *event = pointer_scroll(seat);
+  if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+    event->steps_y += value120;
+  else
+    event->steps_x += value120;
+}
+
+// Discrete steps of pointers older than version 8, they always precede an
+// axis event of the same frame.
+static void pointer_axis_discrete(void *data, struct wl_pointer *wl_pointer,
+                                  uint32_t axis, int32_t discrete) {
+  pointer_axis_value120(data, wl_pointer, axis, discrete * 120);
+}
+
+static void pointer_axis_relative_direction(void *data,
+                                            struct wl_pointer *wl_pointer,
+                                            uint32_t axis,
+                                            uint32_t direction) {
+  (void)data;
+  (void)wl_pointer;
+  (void)axis;
+  (void)direction;
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+    .enter = pointer_enter,
+    .leave = pointer_leave,
+    .motion = pointer_motion,
+    .button = pointer_button,
+    .axis = pointer_axis,
+    .frame = pointer_frame,
+    .axis_source = pointer_axis_source,
+    .axis_stop = pointer_axis_stop,
+    .axis_discrete = pointer_axis_discrete,
+    .axis_value120 = pointer_axis_value120,
+    .axis_relative_direction = pointer_axis_relative_direction,
+};
+
+static void keyboard_deliver(struct sinit_seat *seat,
+                             struct sinit_input_event *event) {
+  if (seat->keyboard_focus == NULL)
+    return;
+
+  event->modifiers = seat->modifiers;
+  input_deliver(seat->keyboard_focus, event, 1);
+}
+
+static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
+                            uint32_t format, int32_t fd, uint32_t size) {
+  (void)wl_keyboard;
+
+  struct sinit_seat *seat = data;
+  if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+    LOG_ERR("unsupported keymap format %d", format);
+    close(fd);
+    return;
+  }
+
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    LOG_ERR("failed to map keymap: %m");
+    return;
+  }
+
+  if (state.xkb_context == NULL)
+    state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+
+  struct xkb_keymap *keymap = NULL;
+  if (state.xkb_context != NULL)
+    keymap = xkb_keymap_new_from_string(state.xkb_context, map,
+                                        XKB_KEYMAP_FORMAT_TEXT_V1,
+                                        XKB_KEYMAP_COMPILE_NO_FLAGS);
+  munmap(map, size);
+
+  struct xkb_state *xkb_state = keymap != NULL ? xkb_state_new(keymap) : NULL;
+  if (xkb_state == NULL) {
+    LOG_ERR("failed to compile keymap");
+    if (keymap != NULL)
+      xkb_keymap_unref(keymap);
+    return;
+  }
+
+  if (seat->xkb_state != NULL)
+    xkb_state_unref(seat->xkb_state);
+  if (seat->keymap != NULL)
+    xkb_keymap_unref(seat->keymap);
+  seat->keymap = keymap;
+  seat->xkb_state = xkb_state;
+  seat->modifiers = 0;
+  for (size_t i = 0; i < ALEN(modifier_names); i++)
+    seat->mod_indices[i] = xkb_keymap_mod_get_index(keymap, modifier_names[i]);
+}
+
+static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
+                           uint32_t serial, struct wl_surface *surface,
+                           struct wl_array *keys) {
+  (void)wl_keyboard;
+  (void)serial;
+  (void)keys;
+
+  struct sinit_seat *seat = data;
+  seat->keyboard_focus = surface_from_wl(surface);
+  keyboard_deliver(seat,
+                   &(struct sinit_input_event){.type = SINIT_KEYBOARD_ENTER});
+}
+
+static void keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
+                           uint32_t serial, struct wl_surface *surface) {
+  (void)wl_keyboard;
+  (void)serial;
+  (void)surface;
+
+  struct sinit_seat *seat = data;
+  keyboard_deliver(seat,
+                   &(struct sinit_input_event){.type = SINIT_KEYBOARD_LEAVE});
+  seat->keyboard_focus = NULL;
+}
+
+static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
+                         uint32_t serial, uint32_t time, uint32_t key,
+                         uint32_t key_state) {
+  (void)wl_keyboard;
+  (void)serial;
+
+  struct sinit_seat *seat = data;
+  if (seat->keyboard_focus == NULL || seat->xkb_state == NULL)
+    return;
+
+  struct sinit_input_event event = {
+      .type = SINIT_KEY,
+      .time = time,
+      .code = key,
+      .pressed = key_state == WL_KEYBOARD_KEY_STATE_PRESSED,
+  };
+
+  // XKB keycodes are evdev ones offset by 8.
+  xkb_keycode_t keycode = key + 8;
+  event.keysym = xkb_state_key_get_one_sym(seat->xkb_state, keycode);
+  if (event.pressed)
+    xkb_state_key_get_utf8(seat->xkb_state, keycode, event.text,
+                           sizeof(event.text));
+  keyboard_deliver(seat, &event);
+}
+
+static void keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+                               uint32_t serial, uint32_t depressed,
+                               uint32_t latched, uint32_t locked,
+                               uint32_t group) {
+  (void)wl_keyboard;
+  (void)serial;
+
+  struct sinit_seat *seat = data;
+  if (seat->xkb_state == NULL)
+    return;
+
+  xkb_state_update_mask(seat->xkb_state, depressed, latched, locked, 0, 0,
+                        group);
+
+  uint32_t modifiers = 0;
+  for (size_t i = 0; i < ALEN(modifier_names); i++) {
+    if (seat->mod_indices[i] != XKB_MOD_INVALID &&
+        xkb_state_mod_index_is_active(seat->xkb_state, seat->mod_indices[i],
+                                      XKB_STATE_MODS_EFFECTIVE) > 0)
+      modifiers |= 1u << i;
+  }
+
+  if (modifiers == seat->modifiers)
+    return;
+
+  seat->modifiers = modifiers;
+  keyboard_deliver(seat, &(struct sinit_input_event){.type = SINIT_MODIFIERS});
+}
+
+static void keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
+                                 int32_t rate, int32_t delay) {
+  (void)data;
+  (void)wl_keyboard;
+  (void)rate;
+  (void)delay;
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+    .keymap = keyboard_keymap,
+    .enter = keyboard_enter,
+    .leave = keyboard_leave,
+    .key = keyboard_key,
+    .modifiers = keyboard_modifiers,
+    .repeat_info = keyboard_repeat_info,
+};
+
+static struct touch_point *touch_point_find(struct sinit_seat *seat,
+                                            int32_t id) {
+  for (int i = 0; i < SINIT_TOUCH_POINTS; i++) {
+    struct touch_point *point = &seat->touch_points[i];
+    if (point->surface != NULL && point->id == id)
+      return point;
+  }
+  return NULL;
+}
+
+static void touch_down(void *data, struct wl_touch *wl_touch, uint32_t serial,
+                       uint32_t time, struct wl_surface *surface, int32_t id,
+                       wl_fixed_t x, wl_fixed_t y) {
+  (void)wl_touch;
+  (void)serial;
+
+  struct sinit_seat *seat = data;
+  sinit_surface *surf = surface_from_wl(surface);
+  if (surf == NULL)
+    return;
+
+  // Use a free slot.
+  struct touch_point *point = touch_point_find(seat, id);
+  for (int i = 0; point == NULL && i < SINIT_TOUCH_POINTS; i++)
+    if (seat->touch_points[i].surface == NULL)
+      point = &seat->touch_points[i];
+  if (point == NULL)
+    return;
+
+  point->id = id;
+  point->surface = surf;
+
+  struct sinit_input_event *event =
+      input_batch_push(&seat->touch_events, surf, SINIT_TOUCH_DOWN);
+  event->time = time;
+  event->id = id;
+  event->x = wl_fixed_to_double(x);
+  event->y = wl_fixed_to_double(y);
+}
+
+static void touch_up(void *data, struct wl_touch *wl_touch, uint32_t serial,
+                     uint32_t time, int32_t id) {
+  (void)wl_touch;
+  (void)serial;
+
+  struct sinit_seat *seat = data;
+  struct touch_point *point = touch_point_find(seat, id);
+  if (point == NULL)
+    return;
+
+  struct sinit_input_event *event =
+      input_batch_push(&seat->touch_events, point->surface, SINIT_TOUCH_UP);
+  event->time = time;
+  event->id = id;
+  point->surface = NULL;
+}
+
+static void touch_motion(void *data, struct wl_touch *wl_touch, uint32_t time,
+                         int32_t id, wl_fixed_t x, wl_fixed_t y) {
+  (void)wl_touch;
+
+  struct sinit_seat *seat = data;
+  struct touch_point *point = touch_point_find(seat, id);
+  if (point == NULL)
+    return;
+
+  // Merge with previous motion of this point in the same frame.
+  struct input_batch *batch = &seat->touch_events;
+  struct sinit_input_event *event = NULL;
+  for (int i = batch->n - 1; i >= 0; i--) {
+    if (batch->events[i].id != id)
+      continue;
+    if (batch->events[i].type == SINIT_TOUCH_MOTION &&
+        batch->surfaces[i] == point->surface)
+      event = &batch->events[i];
+    break;
+  }
+  if (event == NULL)
+    event = input_batch_push(batch, point->surface, SINIT_TOUCH_MOTION);
+
+  event->time = time;
+  event->id = id;
+  event->x = wl_fixed_to_double(x);
+  event->y = wl_fixed_to_double(y);
+}
+
+static void touch_frame(void *data, struct wl_touch *wl_touch) {
+  (void)wl_touch;
+
+  struct sinit_seat *seat = data;
+  input_batch_flush(&seat->touch_events);
+}
+
+static void touch_cancel(void *data, struct wl_touch *wl_touch) {
+  (void)wl_touch;
+
+  struct sinit_seat *seat = data;
+
+  // Pending events are cancelled too.
+  seat->touch_events.n = 0;
+  for (int i = 0; i < SINIT_TOUCH_POINTS; i++) {
+    struct touch_point *point = &seat->touch_points[i];
+    if (point->surface == NULL)
+      continue;
+
+    struct sinit_input_event *event = input_batch_push(
+        &seat->touch_events, point->surface, SINIT_TOUCH_CANCEL);
+    event->id = point->id;
+    point->surface = NULL;
+  }
+  input_batch_flush(&seat->touch_events);
+}
+
+static void touch_shape(void *data, struct wl_touch *wl_touch, int32_t id,
+                        wl_fixed_t major, wl_fixed_t minor) {
+  (void)data;
+  (void)wl_touch;
+  (void)id;
+  (void)major;
+  (void)minor;
+}
+
+static void touch_orientation(void *data, struct wl_touch *wl_touch,
+                              int32_t id, wl_fixed_t orientation) {
+  (void)data;
+  (void)wl_touch;
+  (void)id;
+  (void)orientation;
+}
+
+static const struct wl_touch_listener touch_listener = {
+    .down = touch_down,
+    .up = touch_up,
+    .motion = touch_motion,
+    .frame = touch_frame,
+    .cancel = touch_cancel,
+    .shape = touch_shape,
+    .orientation = touch_orientation,
+};
+
+static void seat_release_pointer(struct sinit_seat *seat) {
+  pointer_leave(seat, seat->pointer, 0, NULL);
+  input_batch_flush(&seat->pointer_events);
+
+  if (seat->cursor_shape != NULL)
+    wp_cursor_shape_device_v1_destroy(seat->cursor_shape);
+  if (wl_proxy_get_version((struct wl_proxy *)seat->pointer) >=
+      WL_POINTER_RELEASE_SINCE_VERSION)
+    wl_pointer_release(seat->pointer);
+  else
+    wl_pointer_destroy(seat->pointer);
+  seat->pointer = NULL;
+  seat->cursor_shape = NULL;
+}
+
+static void seat_release_keyboard(struct sinit_seat *seat) {
+  keyboard_leave(seat, seat->keyboard, 0, NULL);
+
+  if (wl_proxy_get_version((struct wl_proxy *)seat->keyboard) >=
+      WL_KEYBOARD_RELEASE_SINCE_VERSION)
+    wl_keyboard_release(seat->keyboard);
+  else
+    wl_keyboard_destroy(seat->keyboard);
+  seat->keyboard = NULL;
+}
+
+static void seat_release_touch(struct sinit_seat *seat) {
+  touch_cancel(seat, seat->touch);
+
+  if (wl_proxy_get_version((struct wl_proxy *)seat->touch) >=
+      WL_TOUCH_RELEASE_SINCE_VERSION)
+    wl_touch_release(seat->touch);
+  else
+    wl_touch_destroy(seat->touch);
+  seat->touch = NULL;
+}
+
+// Creates or destroys cursor shape devices of pointers depending on whether
+// cursor shape manager is bound.
+static void seats_sync_cursor_shape(struct sinit_state *state) {
+  tll_foreach(state->seats, it) {
+    struct sinit_seat *seat = it->item;
+    if (state->cursor_shape_manager == NULL && seat->cursor_shape != NULL) {
+      wp_cursor_shape_device_v1_destroy(seat->cursor_shape);
+      seat->cursor_shape = NULL;
+    } else if (state->cursor_shape_manager != NULL && seat->pointer != NULL &&
+               seat->cursor_shape == NULL) {
+      seat->cursor_shape = wp_cursor_shape_manager_v1_get_pointer(
+          state->cursor_shape_manager, seat->pointer);
+    }
+  }
+}
+
+static void seat_capabilities(void *data, struct wl_seat *wl_seat,
+                              uint32_t caps) {
+  struct sinit_seat *seat = data;
+
+  bool pointer = caps & WL_SEAT_CAPABILITY_POINTER;
+  if (pointer && seat->pointer == NULL) {
+    seat->pointer = wl_seat_get_pointer(wl_seat);
+    wl_pointer_add_listener(seat->pointer, &pointer_listener, seat);
+    seat->pointer_frames = wl_proxy_get_version((struct wl_proxy *)wl_seat) >=
+                           WL_POINTER_FRAME_SINCE_VERSION;
+    if (state.cursor_shape_manager != NULL)
+      seat->cursor_shape = wp_cursor_shape_manager_v1_get_pointer(
+          state.cursor_shape_manager, seat->pointer);
+  } else if (!pointer && seat->pointer != NULL) {
+    seat_release_pointer(seat);
+  }
+
+  bool keyboard = caps & WL_SEAT_CAPABILITY_KEYBOARD;
+  if (keyboard && seat->keyboard == NULL) {
+    seat->keyboard = wl_seat_get_keyboard(wl_seat);
+    wl_keyboard_add_listener(seat->keyboard, &keyboard_listener, seat);
+  } else if (!keyboard && seat->keyboard != NULL) {
+    seat_release_keyboard(seat);
+  }
+
+  bool touch = caps & WL_SEAT_CAPABILITY_TOUCH;
+  if (touch && seat->touch == NULL) {
+    seat->touch = wl_seat_get_touch(wl_seat);
+    wl_touch_add_listener(seat->touch, &touch_listener, seat);
+  } else if (!touch && seat->touch != NULL) {
+    seat_release_touch(seat);
+  }
+}
+
+static void seat_name(void *data, struct wl_seat *wl_seat, const char *name) {
+  (void)data;
+  (void)wl_seat;
+
+  LOG_DBG("seat %s", name);
+}
+
+static const struct wl_seat_listener seat_listener = {
+    .capabilities = seat_capabilities,
+    .name = seat_name,
+};
+
+static void seat_add(struct sinit_state *state, struct wl_registry *registry,
+                     uint32_t name, uint32_t version) {
+  struct sinit_seat *seat = calloc(1, sizeof(*seat));
+  if (seat == NULL)
+    LOG_FATAL("failed to allocate seat");
+
+  seat->global = name;
+  // Version 8 adds high-resolution wheel scrolling.
+  seat->wl_seat = wl_registry_bind(registry, name, &wl_seat_interface,
+                                   version < 8 ? version : 8);
+  wl_seat_add_listener(seat->wl_seat, &seat_listener, seat);
+  tll_push_back(state->seats, seat);
+}
+
+static void seat_destroy(struct sinit_seat *seat) {
+  if (seat->pointer != NULL)
+    seat_release_pointer(seat);
+  if (seat->keyboard != NULL)
+    seat_release_keyboard(seat);
+  if (seat->touch != NULL)
+    seat_release_touch(seat);
+  if (seat->xkb_state != NULL)
+    xkb_state_unref(seat->xkb_state);
+  if (seat->keymap != NULL)
+    xkb_keymap_unref(seat->keymap);
+
+  if (wl_proxy_get_version((struct wl_proxy *)seat->wl_seat) >=
+      WL_SEAT_RELEASE_SINCE_VERSION)
+    wl_seat_release(seat->wl_seat);
+  else
+    wl_seat_destroy(seat->wl_seat);
+  free(seat);
+}
+
+// Removes seat with the given global name. Returns false if there is none.
+static bool seat_remove(struct sinit_state *state, uint32_t name) {
+  tll_foreach(state->seats, it) {
+    if (it->item->global != name)
+      continue;
+
+    seat_destroy(it->item);
+    tll_remove(state->seats, it);
+    return true;
+  }
+
+  return false;
+}
+
+// Drops all references to surf held by seats.
+static void seats_forget_surface(sinit_surface *surf) {
+  tll_foreach(state.seats, it) {
+    struct sinit_seat *seat = it->item;
+    if (seat->pointer_focus == surf)
+      seat->pointer_focus = NULL;
+    if (seat->keyboard_focus == surf)
+      seat->keyboard_focus = NULL;
+    for (int i = 0; i < SINIT_TOUCH_POINTS; i++)
+      if (seat->touch_points[i].surface == surf)
+        seat->touch_points[i].surface = NULL;
+    input_batch_forget(&seat->pointer_events, surf);
+    input_batch_forget(&seat->touch_events, surf);
+  }
+}
+
+/* Private helper function */
+
+// Rounds size up to a multiple of page size of a shm file.
+static size_t shm_page_align(size_t size, bool hugetlb) {
+  size_t page = hugetlb ? SINIT_HUGEPAGE_SIZE : (size_t)getpagesize();
+  return (size + page - 1) / page * page;
+}
+
+static int create_tmp_shm_file(void) {
+  char template[] = "/tmp/wayland-shm-XXXXXX";
+  int fd = mkstemp(template);
+  if (fd < 0)
+    return -1;
+
+  unlink(template);
+  return fd;
+}
+
+// Creates an anonymous shared memory file of the given size. Size is rounded
+// up to the file page size and hugetlb is set if file is backed by explicit
+// huge pages.
+static int create_shm_file(size_t *size, bool *hugetlb) {
+  int fd = -1;
+  unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+
+  *hugetlb = false;
+  if (state.hugetlb && *size >= SINIT_HUGEPAGE_THRESHOLD) {
+    fd = memfd_create("sinit-shm", flags | MFD_HUGETLB);
+    if (fd < 0)
+      LOG_DBG("failed to create hugetlb memfd, falling back to regular pages: "
+              "%m");
+    else
+      *hugetlb = true;
+  }
+
+  if (fd < 0)
+    fd = memfd_create("sinit-shm", flags);
+
+  // Kernel without memfd support.
+  if (fd < 0 && errno == ENOSYS)
+    fd = create_tmp_shm_file();
+
+  if (fd < 0)
+    return -1;
+
+  *size = shm_page_align(*size, *hugetlb);
+  if (ftruncate(fd, *size) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  // Pool can only grow, prevent anyone from shrinking it under the
+  // compositor's feet. This fails on non memfd files and that's fine.
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+
+  return fd;
+}
+
+// Advises kernel to back large regular pools with transparent huge pages.
+static void shm_advise(void *data, size_t size, bool hugetlb) {
+  if (hugetlb || size < SINIT_HUGEPAGE_THRESHOLD)
+    return;
+
+  if (madvise(data, size, MADV_HUGEPAGE) < 0)
+    LOG_DBG("failed to advise huge pages for shm pool: %m");
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+  (void)wl_buffer;
+
+  struct sinit_buffer *buf = data;
+  sinit_surface *surf = buf->swapchain->surface;
+
+  buf->busy = false;
+
+  // A frame was dropped because all buffers were busy, render it now.
+  if (surf->base.render_pending)
+    sinit_surface_render(surf, surf->base.pending_render);
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void swapchain_init(struct sinit_swapchain *sc, sinit_surface *surf) {
+  *sc = (struct sinit_swapchain){0};
+  sc->surface = surf;
+  sc->fd = -1;
+  for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++)
+    sc->buffers[i].swapchain = sc;
+}
+
+static void destroy_wl_buffer(struct sinit_buffer *buf);
+
+// Destroys swapchain pool along with its buffers. Compositor keeps its own
+// mapping of buffers it still holds.
+static void swapchain_drop_pool(struct sinit_swapchain *sc) {
+  for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++)
+    if (sc->buffers[i].wl_buffer != NULL)
+      destroy_wl_buffer(&sc->buffers[i]);
+  if (sc->pool != NULL)
+    wl_shm_pool_destroy(sc->pool);
+  if (sc->data != NULL)
+    munmap(sc->data, sc->size);
+  if (sc->fd >= 0)
+    close(sc->fd);
+
+  sc->pool = NULL;
+  sc->fd = -1;
+  sc->data = NULL;
+  sc->size = 0;
+  sc->hugetlb = false;
+  sc->front = NULL;
+}
+
+// Grows swapchain pool so it is at least size bytes long. Pool never shrinks
+// as wl_shm_pool can't.
+static void swapchain_reserve(struct sinit_swapchain *sc, size_t size) {
+  if (size <= sc->size)
+    return;
+
+  // Linux can't expand hugetlb mappings, neither here nor in the compositor
+  // handling wl_shm_pool.resize. Pool is replaced instead, pool only grows
+  // along with buffers geometry so their content is repainted anyway.
+  if (sc->hugetlb) {
+    LOG_DBG("replacing hugetlb swapchain pool of %zu bytes", sc->size);
+    swapchain_drop_pool(sc);
+  }
+
+  if (sc->fd < 0) {
+    sc->fd = create_shm_file(&size, &sc->hugetlb);
+    if (sc->fd < 0)
+      LOG_FATAL("failed to create shm file: %m (size=%zu)", size);
+
+    sc->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sc->fd, 0);
+    if (sc->data == MAP_FAILED)
+      LOG_FATAL("failed to mmap file: %m (size=%zu)", size);
+
+    sc->pool = wl_shm_create_pool(state.shm, sc->fd, size);
+  } else {
+    size = shm_page_align(size, sc->hugetlb);
+    if (ftruncate(sc->fd, size) < 0)
+      LOG_FATAL("failed to grow shm file: %m (size=%zu)", size);
+
+    sc->data = mremap(sc->data, sc->size, size, MREMAP_MAYMOVE);
+    if (sc->data == MAP_FAILED)
+      LOG_FATAL("failed to remap shm file: %m (size=%zu)", size);
+
+    wl_shm_pool_resize(sc->pool, size);
+
+    // Mapping may have moved.
+    for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++) {
+      struct sinit_buffer *buf = &sc->buffers[i];
+      if (buf->wl_buffer != NULL)
+        buf->data = (char *)sc->data + buf->offset;
+    }
+  }
+
+  shm_advise(sc->data, size, sc->hugetlb);
+
+  LOG_DBG("swapchain pool resized from %zu to %zu bytes", sc->size, size);
+  sc->size = size;
+}
+
+// Rounds buffer size up to the next size of the form 2^n or 3 * 2^(n-1), so
+// that slots grow geometrically during interactive resizes.
+static size_t slot_bucket(size_t size) {
+  size_t bucket = 4096;
+  while (bucket < size) {
+    if (bucket + bucket / 2 >= size)
+      return bucket + bucket / 2;
+    bucket *= 2;
+  }
+  return bucket;
+}
+
+// Resizes swapchain buffers or changes their format. Existing buffers are
+// recreated lazily by swapchain_acquire().
+static void swapchain_resize(struct sinit_swapchain *sc, int width, int height,
+                             enum sinit_format format) {
+  sc->width = width;
+  sc->height = height;
+  sc->format = format;
+  // Keep rows 4 bytes aligned for 16 bits formats.
+  sc->stride = (formats[format].bpp * width + 3) & ~3;
+
+  size_t size = (size_t)sc->stride * height;
+  if (size > sc->slot_size) {
+    sc->slot_size = slot_bucket(size);
+    swapchain_reserve(sc, SINIT_SWAPCHAIN_LEN * sc->slot_size);
+  }
+  sc->small_since = sc->frame;
+  sc->trimmed = false;
+}
+
+// Releases memory of slots past current buffers once they stayed at most half
+// as large as slots for SINIT_SWAPCHAIN_TRIM_FRAMES frames.
+static void swapchain_trim(struct sinit_swapchain *sc) {
+  size_t size = (size_t)sc->stride * sc->height;
+  if (sc->trimmed || size > sc->slot_size / 2 ||
+      sc->frame - sc->small_since < SINIT_SWAPCHAIN_TRIM_FRAMES)
+    return;
+
+  // Compositor may still read from a buffer of a previous geometry.
+  for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++) {
+    struct sinit_buffer *buf = &sc->buffers[i];
+    if (buf->busy && (size_t)buf->stride * buf->height > size)
+      return;
+  }
+
+  size_t page = sc->hugetlb ? SINIT_HUGEPAGE_SIZE : (size_t)getpagesize();
+  for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++) {
+    size_t start = shm_page_align(i * sc->slot_size + size, sc->hugetlb);
+    size_t end = (i + 1) * sc->slot_size / page * page;
+    if (end > start &&
+        fallocate(sc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start,
+                  end - start) < 0) {
+      LOG_DBG("failed to release unused swapchain memory: %m");
+      break;
+    }
+  }
+
+  LOG_DBG("swapchain slots trimmed to %zu bytes", size);
+  sc->trimmed = true;
+}
+
+static void create_wl_buffer(struct sinit_swapchain *sc,
+                             struct sinit_buffer *buf, size_t offset) {
+  buf->offset = offset;
+  buf->width = sc->width;
+  buf->height = sc->height;
+  buf->stride = sc->stride;
+  buf->format = sc->format;
+  buf->frame = 0;
+  buf->data = (char *)sc->data + offset;
+  buf->wl_buffer =
+      wl_shm_pool_create_buffer(sc->pool, offset, buf->width, buf->height,
+                                buf->stride, formats[buf->format].shm);
+  wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, buf);
+}
+
+static void destroy_wl_buffer(struct sinit_buffer *buf) {
+  wl_buffer_destroy(buf->wl_buffer);
+  buf->wl_buffer = NULL;
+  buf->data = NULL;
+  buf->busy = false;
+  buf->frame = 0;
+}
+
+// Returns whether memory range [offset, offset+size[ is used by a buffer held
+// by the compositor.
+static bool swapchain_range_busy(struct sinit_swapchain *sc, size_t offset,
+                                 size_t size) {
+  for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++) {
+    struct sinit_buffer *buf = &sc->buffers[i];
+    if (!buf->busy)
+      continue;
+
+    size_t buf_size = (size_t)buf->stride * buf->height;
+    if (offset < buf->offset + buf_size && buf->offset < offset + size)
+      return true;
+  }
+
+  return false;
+}
+
+// Returns a buffer that isn't held by the compositor or NULL if there is none.
+static struct sinit_buffer *swapchain_acquire(struct sinit_swapchain *sc) {
+  size_t size = (size_t)sc->stride * sc->height;
+
+  for (int i = 0; i < SINIT_SWAPCHAIN_LEN; i++) {
+    struct sinit_buffer *buf = &sc->buffers[i];
+    size_t offset = i * sc->slot_size;
+
+    if (buf->busy)
+      continue;
+
+    // Buffer is up to date.
+    if (buf->wl_buffer != NULL && buf->width == sc->width &&
+        buf->height == sc->height && buf->format == sc->format &&
+        buf->offset == offset)
+      return buf;
+
+    // Compositor may still read from a buffer of a previous geometry that
+    // overlaps this one.
+    if (swapchain_range_busy(sc, offset, size))
+      continue;
+
+    if (buf->wl_buffer != NULL)
+      destroy_wl_buffer(buf);
+    create_wl_buffer(sc, buf, offset);
+    return buf;
+  }
+
+  return NULL;
+}
+
+static int rect_area(struct sinit_rect r) { return r.width * r.height; }
+
+static struct sinit_rect rect_union(struct sinit_rect a, struct sinit_rect b) {
+  int x0 = a.x < b.x ? a.x : b.x;
+  int y0 = a.y < b.y ? a.y : b.y;
+  int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+  int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+  return (struct sinit_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+// Clips rectangle to [0, width[ x [0, height[.
+static struct sinit_rect rect_clip(struct sinit_rect r, int width,
+                                   int height) {
+  int x0 = r.x < 0 ? 0 : r.x;
+  int y0 = r.y < 0 ? 0 : r.y;
+  int x1 = r.x + r.width > width ? width : r.x + r.width;
+  int y1 = r.y + r.height > height ? height : r.y + r.height;
+  if (x1 <= x0 || y1 <= y0)
+    return (struct sinit_rect){0};
+  return (struct sinit_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+// Adds rectangle to damage. Rectangles whose bounding box costs no more than
+// both of them are merged, if there is no more room the rectangle is merged
+// with the one it grows the least.
+static void damage_add(struct sinit_damage *d, struct sinit_rect r) {
+  if (rect_area(r) == 0)
+    return;
+
+  for (int i = 0; i < d->n_rects; i++) {
+    struct sinit_rect u = rect_union(d->rects[i], r);
+    if (rect_area(u) <= rect_area(d->rects[i]) + rect_area(r)) {
+      // Merged rectangle may now overlap others.
+      d->rects[i] = d->rects[--d->n_rects];
+      damage_add(d, u);
+      return;
+    }
+  }
+
+  if (d->n_rects < SINIT_DAMAGE_MAX_RECTS) {
+    d->rects[d->n_rects++] = r;
+    return;
+  }
+
+  int best = 0;
+  int best_cost = INT32_MAX;
+  for (int i = 0; i < d->n_rects; i++) {
+    int cost = rect_area(rect_union(d->rects[i], r)) - rect_area(d->rects[i]);
+    if (cost < best_cost) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+  r = rect_union(d->rects[best], r);
+  d->rects[best] = d->rects[--d->n_rects];
+  damage_add(d, r);
+}
+
+// Copies a rectangle between two buffers of the same format.
+static void buffer_copy_rect(struct sinit_buffer *dst,
+                             struct sinit_buffer *src, struct sinit_rect r) {
+  int bpp = formats[dst->format].bpp;
+  for (int y = r.y; y < r.y + r.height; y++) {
+    memcpy((char *)dst->data + (size_t)y * dst->stride + (size_t)r.x * bpp,
+           (char *)src->data + (size_t)y * src->stride + (size_t)r.x * bpp,
+           (size_t)r.width * bpp);
+  }
+}
+
+// Copies regions that changed since buf was last rendered from front buffer,
+// so buf contains the previous frame. Returns false if that's not possible
+// and buf must be repainted entirely.
+static bool swapchain_copy_forward(struct sinit_swapchain *sc,
+                                   struct sinit_buffer *buf) {
+  struct sinit_buffer *front = sc->front;
+
+  if (front == buf)
+    return buf->frame != 0;
+
+  if (front == NULL || front->frame == 0 || front->width != buf->width ||
+      front->height != buf->height || front->format != buf->format)
+    return false;
+
+  uint64_t age = sc->frame - buf->frame;
+  if (buf->frame == 0 || age > SINIT_SWAPCHAIN_LEN) {
+    buffer_copy_rect(buf, front,
+                     (struct sinit_rect){0, 0, buf->width, buf->height});
+    return true;
+  }
+
+  struct sinit_damage damage = {0};
+  for (uint64_t f = buf->frame + 1; f <= sc->frame; f++) {
+    struct sinit_damage *d = &sc->history[f % SINIT_SWAPCHAIN_LEN];
+    for (int i = 0; i < d->n_rects; i++)
+      damage_add(&damage, d->rects[i]);
+  }
+  // History may contain frames of a different geometry.
+  for (int i = 0; i < damage.n_rects; i++)
+    buffer_copy_rect(buf, front,
+                     rect_clip(damage.rects[i], buf->width, buf->height));
+
+  return true;
+}
+
+// Marks buf as the front buffer with the given damage.
+static void swapchain_present(struct sinit_swapchain *sc,
+                              struct sinit_buffer *buf,
+                              struct sinit_damage *damage) {
+  sc->frame++;
+  sc->history[sc->frame % SINIT_SWAPCHAIN_LEN] = *damage;
+  buf->frame = sc->frame;
+  buf->busy = true;
+  sc->front = buf;
+
+  swapchain_trim(sc);
+}
+
+static void swapchain_deinit(struct sinit_swapchain *sc) {
+  swapchain_drop_pool(sc);
+  *sc = (struct sinit_swapchain){0};
+  sc->fd = -1;
+}
+
+static void region_set(struct sinit_region *region,
+                       const struct sinit_rect *rects, int n_rects,
+                       bool merge) {
+  region->n_rects = 0;
+  region->full = rects == NULL;
+  if (rects == NULL)
+    return;
+
+  for (int i = 0; i < n_rects; i++) {
+    if (rect_area(rects[i]) <= 0)
+      continue;
+
+    if (region->n_rects < SINIT_REGION_MAX_RECTS)
+      region->rects[region->n_rects++] = rects[i];
+    else if (merge)
+      region->rects[region->n_rects - 1] =
+          rect_union(region->rects[region->n_rects - 1], rects[i]);
+  }
+}
+
+static bool region_equal(struct sinit_region *a, struct sinit_region *b) {
+  return a->full == b->full && a->n_rects == b->n_rects &&
+         memcmp(a->rects, b->rects, a->n_rects * sizeof(*a->rects)) == 0;
+}
+
+// Sends region if it differs from the last one sent. A full region is sent
+// as a surface sized rectangle if resolve_full is true and as NULL (infinite
+// region) otherwise.
+static void region_update(sinit_surface *surf, struct sinit_region *region,
+                          struct sinit_region *sent, bool resolve_full,
+                          void (*set)(struct wl_surface *,
+                                      struct wl_region *)) {
+  struct sinit_region resolved = *region;
+  if (region->full && resolve_full) {
+    resolved.full = false;
+    resolved.n_rects = 0;
+    if (surf->base.config.width > 0 && surf->base.config.height > 0)
+      resolved.rects[resolved.n_rects++] = (struct sinit_rect){
+          0, 0, surf->base.config.width, surf->base.config.height};
+  }
+
+  if (region_equal(&resolved, sent))
+    return;
+  *sent = resolved;
+
+  struct wl_region *wl_region = NULL;
+  if (!resolved.full) {
+    wl_region = wl_compositor_create_region(state.compositor);
+    for (int i = 0; i < resolved.n_rects; i++)
+      wl_region_add(wl_region, resolved.rects[i].x, resolved.rects[i].y,
+                    resolved.rects[i].width, resolved.rects[i].height);
+  }
+  set(surf->base.wl_surface, wl_region);
+  if (wl_region != NULL)
+    wl_region_destroy(wl_region);
+}
+
+static void surface_init_regions(sinit_surface *surf, bool opaque) {
+  region_set(&surf->base.opaque_region, NULL, 0, false);
+  surf->base.opaque_region.full = opaque;
+  region_set(&surf->base.input_region, NULL, 0, true);
+  // Compositor defaults.
+  surf->base.sent_opaque_region = (struct sinit_region){0};
+  surf->base.sent_input_region = (struct sinit_region){.full = true};
+}
+
+static void surface_init_formats(sinit_surface *surf, bool opaque) {
+  surf->base.n_formats = 0;
+  // Compositor can skip blending of buffers without alpha.
+  if (opaque)
+    surf->base.formats[surf->base.n_formats++] = SINIT_FORMAT_XRGB8888;
+  surf->base.formats[surf->base.n_formats++] = SINIT_FORMAT_ARGB8888;
+}
+
+// Sends changed regions and commits surface.
+static void surface_commit(sinit_surface *surf) {
+  region_update(surf, &surf->base.opaque_region,
+                &surf->base.sent_opaque_region, true,
+                wl_surface_set_opaque_region);
+  region_update(surf, &surf->base.input_region, &surf->base.sent_input_region,
+                false, wl_surface_set_input_region);
+  wl_surface_commit(surf->base.wl_surface);
+}
+
+/* Event loop */
+
+static uint64_t clock_now(clockid_t clock_id) {
+  struct timespec ts;
+  clock_gettime(clock_id, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void source_add(struct sinit_source *source) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = source};
+  if (epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, source->fd, &ev) < 0)
+    LOG_FATAL("failed to add fd %d to epoll: %m", source->fd);
+}
+
+static void source_remove(struct sinit_source *source) {
+  if (epoll_ctl(state.epoll_fd, EPOLL_CTL_DEL, source->fd, NULL) < 0)
+    LOG_ERR("failed to remove fd %d from epoll: %m", source->fd);
+
+  // Source may be freed before the rest of the batches is dispatched.
+  for (struct dispatch_batch *b = state.batch; b != NULL; b = b->outer)
+    for (int i = 0; i < b->len; i++)
+      if (b->events[i].data.ptr == source)
+        b->events[i].data.ptr = NULL;
+}
+
+// Watches display fd for writability until buffered requests are flushed.
+static void display_watch_output(bool enable) {
+  if (state.flush_pending == enable)
+    return;
+
+  struct epoll_event ev = {
+      .events = enable ? EPOLLIN | EPOLLOUT : EPOLLIN,
+      .data.ptr = &state.display_source,
+  };
+  if (epoll_ctl(state.epoll_fd, EPOLL_CTL_MOD, state.display_source.fd,
+                &ev) < 0) {
+    LOG_ERR("failed to modify display fd %d in epoll: %m",
+            state.display_source.fd);
+    return;
+  }
+  state.flush_pending = enable;
+}
+
+// Events are read by sinit_dispatch_pending(), only flush remaining requests
+// once socket is writable again.
+static void display_dispatch(struct sinit_source *source, uint32_t events) {
+  (void)source;
+
+  if (events & EPOLLOUT && sinit_flush() < 0)
+    LOG_ERR("failed to flush display: %m");
+}
+
+/* Render pool */
+
+static void render_job_run(struct sinit_render_job *job);
+static void render_job_commit(struct sinit_render_job *job);
+
+static void *render_worker_main(void *data) {
+  struct render_pool *pool = data;
+  render_worker = true;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (tll_length(pool->queue) == 0 && !pool->stop)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->stop)
+      break;
+
+    struct sinit_render_job *job = tll_pop_front(pool->queue);
+    pthread_mutex_unlock(&pool->lock);
+
+    render_job_run(job);
+
+    pthread_mutex_lock(&pool->lock);
+    job->done = true;
+    tll_push_back(pool->done, job);
+    pthread_cond_broadcast(&pool->done_cond);
+
+    uint64_t one = 1;
+    if (write(pool->source.fd, &one, sizeof(one)) < 0)
+      LOG_ERR("failed to signal render completion: %m");
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+// Commits jobs completed by workers.
+static void render_pool_dispatch(struct sinit_source *source,
+                                 uint32_t events) {
+  (void)events;
+
+  struct render_pool *pool = CONTAINER_OF(source, struct render_pool, source);
+
+  uint64_t count;
+  if (read(source->fd, &count, sizeof(count)) < 0)
+    return;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    struct sinit_render_job *job =
+        tll_length(pool->done) > 0 ? tll_pop_front(pool->done) : NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (job == NULL)
+      break;
+    render_job_commit(job);
+  }
+}
+
+static void render_pool_start(struct render_pool *pool, int n_threads) {
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->stop = false;
+
+  pool->source.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (pool->source.fd < 0)
+    LOG_FATAL("failed to create render pool eventfd: %m");
+  pool->source.dispatch = render_pool_dispatch;
+  source_add(&pool->source);
+
+  pool->threads = calloc(n_threads, sizeof(*pool->threads));
+  if (pool->threads == NULL)
+    LOG_FATAL("failed to allocate render threads: %m");
+
+  for (int i = 0; i < n_threads; i++) {
+    int r = pthread_create(&pool->threads[i], NULL, render_worker_main, pool);
+    if (r != 0)
+      LOG_FATAL("failed to create render thread: %s", strerror(r));
+  }
+  pool->n_threads = n_threads;
+
+  LOG_DBG("render pool started with %d threads", n_threads);
+}
+
+static void render_pool_stop(struct render_pool *pool) {
+  if (pool->n_threads == 0)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->n_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+  free(pool->threads);
+  pool->threads = NULL;
+  pool->n_threads = 0;
+
+  tll_free(pool->queue);
+  tll_free(pool->done);
+  source_remove(&pool->source);
+  close(pool->source.fd);
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+static void render_pool_submit(struct render_pool *pool,
+                               struct sinit_render_job *job) {
+  pthread_mutex_lock(&pool->lock);
+  tll_push_back(pool->queue, job);
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Waits for an in flight job and drops it without committing it. This must be
+// called before touching surface buffers (e.g. on resize).
+static void render_pool_cancel(struct render_pool *pool,
+                               struct sinit_render_job *job) {
+  if (!job->in_flight)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  bool queued = false;
+  tll_foreach(pool->queue, it) {
+    if (it->item == job) {
+      tll_remove(pool->queue, it);
+      queued = true;
+    }
+  }
+  if (!queued) {
+    while (!job->done)
+      pthread_cond_wait(&pool->done_cond, &pool->lock);
+    tll_foreach(pool->done, it) {
+      if (it->item == job)
+        tll_remove(pool->done, it);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  // Buffer content is undefined.
+  job->buffer->frame = 0;
+  job->in_flight = false;
+  job->done = false;
+
+  if (job->frame_requested) {
+    job->frame_requested = false;
+    sinit_surface_request_frame(job->surface);
+  }
+}
+
+/* Tiles */
+
+static int tiles_count(struct sinit_tiles *t) { return t->cols * t->rows; }
+
+static void tiles_invalidate_all(struct sinit_tiles *t) {
+  int n = tiles_count(t);
+  for (int i = 0; i < n; i += 64)
+    t->dirty[i / 64] = n - i >= 64 ? UINT64_MAX : (1ull << (n - i)) - 1;
+}
+
+// Recomputes tile grid of a width x height buffer and invalidates every tile.
+static void tiles_resize(struct sinit_tiles *t, int width, int height) {
+  if (t->render == NULL)
+    return;
+
+  t->cols = (width + t->size - 1) / t->size;
+  t->rows = (height + t->size - 1) / t->size;
+
+  int n = tiles_count(t);
+  t->dirty = realloc(t->dirty, ((n + 63) / 64 + 1) * sizeof(*t->dirty));
+  t->list = realloc(t->list, (n + 1) * sizeof(*t->list));
+  if (t->dirty == NULL || t->list == NULL)
+    LOG_FATAL("failed to allocate tiles: %m");
+  t->n_list = 0;
+
+  tiles_invalidate_all(t);
+}
+
+static void tiles_deinit(struct sinit_tiles *t) {
+  free(t->dirty);
+  free(t->list);
+  *t = (struct sinit_tiles){0};
+}
+
+static bool tiles_dirty(struct sinit_tiles *t) {
+  for (int i = 0; i < tiles_count(t); i += 64)
+    if (t->dirty[i / 64] != 0)
+      return true;
+  return false;
+}
+
+static struct sinit_rect tile_rect(struct sinit_tiles *t, int index,
+                                   int width, int height) {
+  return rect_clip((struct sinit_rect){index % t->cols * t->size,
+                                       index / t->cols * t->size, t->size,
+                                       t->size},
+                   width, height);
+}
+
+// Moves dirty tiles, or all tiles, to tile list and adds them to damage.
+static void tiles_collect(struct sinit_tiles *t, bool all,
+                          struct sinit_damage *damage, int width,
+                          int height) {
+  if (all)
+    tiles_invalidate_all(t);
+
+  t->n_list = 0;
+  for (int i = 0; i < tiles_count(t); i++) {
+    if (!(t->dirty[i / 64] & (1ull << (i % 64))))
+      continue;
+    t->list[t->n_list++] = i;
+    damage_add(damage, tile_rect(t, i, width, height));
+  }
+
+  memset(t->dirty, 0, (tiles_count(t) + 63) / 64 * sizeof(*t->dirty));
+}
+
+static void render_tile(struct sinit_render_job *job, int index) {
+  sinit_surface *surf = job->surface;
+  struct sinit_tiles *t = &surf->base.tiles;
+  struct sinit_buffer *buf = job->buffer;
+
+  struct sinit_rect r = tile_rect(t, index, buf->width, buf->height);
+  char *data = (char *)buf->data + (size_t)r.y * buf->stride +
+               (size_t)r.x * formats[buf->format].bpp;
+  t->render(surf, data, buf->stride, buf->format, r, job->scale, job->time,
+            surf->base.userdata);
+}
+
+// Renders tiles of current batch, starting with queue self and then stealing
+// from other queues.
+static void tile_pool_work(struct tile_pool *pool, int self) {
+  struct sinit_render_job *job = pool->job;
+  int *tiles = job->surface->base.tiles.list;
+  int n_queues = pool->n_threads + 1;
+
+  for (int q = 0; q < n_queues; q++) {
+    struct tile_queue *queue = &pool->queues[(self + q) % n_queues];
+    for (;;) {
+      int i = atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed);
+      if (i >= queue->end)
+        break;
+      render_tile(job, tiles[i]);
+    }
+  }
+}
+
+static void *tile_worker_main(void *data) {
+  struct tile_pool *pool = data;
+  uint64_t generation = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  int self = pool->n_started++;
+  for (;;) {
+    while (pool->generation == generation && !pool->stop)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->stop)
+      break;
+    generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    tile_pool_work(pool, self);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0)
+      pthread_cond_signal(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+static void tile_pool_start(struct tile_pool *pool, int n_threads) {
+  pthread_mutex_init(&pool->batch_lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->generation = 0;
+  pool->active = 0;
+  pool->n_started = 0;
+  pool->stop = false;
+
+  pool->threads = calloc(n_threads, sizeof(*pool->threads));
+  pool->queues = aligned_alloc(_Alignof(struct tile_queue),
+                               (n_threads + 1) * sizeof(*pool->queues));
+  if (pool->threads == NULL || pool->queues == NULL)
+    LOG_FATAL("failed to allocate tile threads: %m");
+
+  for (int i = 0; i < n_threads; i++) {
+    int r = pthread_create(&pool->threads[i], NULL, tile_worker_main, pool);
+    if (r != 0)
+      LOG_FATAL("failed to create tile thread: %s", strerror(r));
+  }
+  pool->n_threads = n_threads;
+
+  LOG_DBG("tile pool started with %d threads", n_threads);
+}
+
+static void tile_pool_stop(struct tile_pool *pool) {
+  if (pool->n_threads == 0)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->n_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+  free(pool->threads);
+  free(pool->queues);
+  pool->threads = NULL;
+  pool->queues = NULL;
+  pool->n_threads = 0;
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->batch_lock);
+}
+
+// Renders tiles listed by job's surface using calling thread and tile
+// threads.
+static void tile_pool_run(struct tile_pool *pool,
+                          struct sinit_render_job *job) {
+  int n_tiles = job->surface->base.tiles.n_list;
+
+  if (pool->n_threads == 0 || n_tiles <= 1) {
+    for (int i = 0; i < n_tiles; i++)
+      render_tile(job, job->surface->base.tiles.list[i]);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->batch_lock);
+
+  // Split tiles in contiguous ranges, neighbour tiles likely cost the same.
+  int n_queues = pool->n_threads + 1;
+  for (int q = 0; q < n_queues; q++) {
+    atomic_store_explicit(&pool->queues[q].next, n_tiles * q / n_queues,
+                          memory_order_relaxed);
+    pool->queues[q].end = n_tiles * (q + 1) / n_queues;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->active = pool->n_threads;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  tile_pool_work(pool, pool->n_threads);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active > 0)
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pool->job = NULL;
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_unlock(&pool->batch_lock);
+}
+
+/* Frame scheduler */
+
+static void feedback_destroy(struct sinit_feedback *f) {
+  wp_presentation_feedback_destroy(f->feedback);
+  f->feedback = NULL;
+}
+
+// Returns predicted time of the first vblank after t or 0 if unknown.
+static uint64_t frame_scheduler_next_vblank(struct sinit_frame_scheduler *sched,
+                                            uint64_t t) {
+  if (sched->refresh == 0 || sched->presented_time == 0)
+    return 0;
+  if (t < sched->presented_time)
+    return sched->presented_time;
+
+  uint64_t n = (t - sched->presented_time) / sched->refresh + 1;
+  return sched->presented_time + n * sched->refresh;
+}
+
+static void feedback_sync_output(void *data,
+                                 struct wp_presentation_feedback *feedback,
+                                 struct wl_output *output) {
+  (void)data;
+  (void)feedback;
+  (void)output;
+}
+
+static void feedback_presented(void *data,
+                               struct wp_presentation_feedback *feedback,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                               uint32_t tv_nsec, uint32_t refresh,
+                               uint32_t seq_hi, uint32_t seq_lo,
+                               uint32_t flags) {
+  (void)feedback;
+  (void)seq_hi;
+  (void)seq_lo;
+  (void)flags;
+
+  struct sinit_feedback *f = data;
+  struct sinit_frame_scheduler *sched = f->scheduler;
+  uint64_t presented =
+      (((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * NSEC_PER_SEC + tv_nsec;
+
+  // Frame wasn't presented on the vblank following its commit.
+  uint64_t target = frame_scheduler_next_vblank(sched, f->commit_time);
+  if (target != 0 && presented > target + sched->refresh / 2)
+    sched->missed++;
+
+  size_t i = sched->presented % SINIT_STATS_LEN;
+  uint64_t latency =
+      presented > f->commit_time ? presented - f->commit_time : 0;
+  sched->latencies[i] = latency > UINT32_MAX ? UINT32_MAX : latency;
+  uint64_t frame_time = 0;
+  if (sched->presented_time != 0 && presented > sched->presented_time)
+    frame_time = presented - sched->presented_time;
+  sched->frame_times[i] = frame_time > UINT32_MAX ? UINT32_MAX : frame_time;
+
+  sched->refresh = refresh;
+  sched->presented_time = presented;
+  sched->presented++;
+
+  feedback_destroy(f);
+}
+
+static void feedback_discarded(void *data,
+                               struct wp_presentation_feedback *feedback) {
+  (void)feedback;
+
+  struct sinit_feedback *f = data;
+  f->scheduler->dropped++;
+  feedback_destroy(f);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = feedback_presented,
+    .discarded = feedback_discarded,
+};
+
+static void frame_timer_dispatch(struct sinit_source *source,
+                                 uint32_t events) {
+  (void)events;
+
+  struct sinit_frame_scheduler *sched =
+      CONTAINER_OF(source, struct sinit_frame_scheduler, timer);
+
+  uint64_t expirations;
+  if (read(source->fd, &expirations, sizeof(expirations)) < 0)
+    return;
+
+  sched->armed = false;
+  sinit_surface_render(sched->surface, sched->pending_time);
+}
+
+static void frame_scheduler_init(struct sinit_frame_scheduler *sched,
+                                 sinit_surface *surf) {
+  *sched = (struct sinit_frame_scheduler){0};
+  sched->surface = surf;
+  sched->margin = SINIT_DEFAULT_FRAME_MARGIN_NS;
+
+  sched->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (sched->timer.fd < 0)
+    LOG_FATAL("failed to create frame timer: %m");
+  sched->timer.dispatch = frame_timer_dispatch;
+  source_add(&sched->timer);
+}
+
+// Destroys presentation feedbacks in flight, e.g. because presentation global
+// is gone.
+static void
+frame_scheduler_drop_feedbacks(struct sinit_frame_scheduler *sched) {
+  for (int i = 0; i < SINIT_FEEDBACK_LEN; i++)
+    if (sched->feedbacks[i].feedback != NULL)
+      feedback_destroy(&sched->feedbacks[i]);
+}
+
+static void frame_scheduler_deinit(struct sinit_frame_scheduler *sched) {
+  frame_scheduler_drop_feedbacks(sched);
+  source_remove(&sched->timer);
+  close(sched->timer.fd);
+  sched->timer.fd = -1;
+}
+
+// Renders surface right away or arms frame timer so that render completes
+// margin nanoseconds before next vblank.
+static void frame_scheduler_schedule(struct sinit_frame_scheduler *sched,
+                                     uint32_t time) {
+  uint64_t now = clock_now(state.clock_id);
+  uint64_t vblank = frame_scheduler_next_vblank(sched, now);
+  uint64_t budget = sched->margin + 2 * sched->render_time;
+
+  if (vblank == 0 || vblank < now + budget + FRAME_TIMER_SLACK_NS) {
+    sinit_surface_render(sched->surface, time);
+    return;
+  }
+
+  uint64_t delay = vblank - budget - now;
+  struct itimerspec its = {
+      .it_value = {.tv_sec = delay / NSEC_PER_SEC,
+                   .tv_nsec = delay % NSEC_PER_SEC},
+  };
+  if (timerfd_settime(sched->timer.fd, 0, &its, NULL) < 0) {
+    LOG_ERR("failed to arm frame timer: %m");
+    sinit_surface_render(sched->surface, time);
+    return;
+  }
+
+  sched->armed = true;
+  sched->pending_time = time;
+}
+
+// Requests presentation feedback for next surface commit.
+static void frame_scheduler_feedback(struct sinit_frame_scheduler *sched,
+                                     struct wl_surface *wl_surface) {
+  if (state.presentation == NULL)
+    return;
+
+  struct sinit_feedback *f = NULL;
+  for (int i = 0; i < SINIT_FEEDBACK_LEN; i++) {
+    if (sched->feedbacks[i].feedback == NULL) {
+      f = &sched->feedbacks[i];
+      break;
+    }
+  }
+  if (f == NULL)
+    return;
+
+  f->scheduler = sched;
+  f->commit_time = clock_now(state.clock_id);
+  f->feedback = wp_presentation_feedback(state.presentation, wl_surface);
+  wp_presentation_feedback_add_listener(f->feedback, &feedback_listener, f);
+}
+
+static void frame_scheduler_rendered(struct sinit_frame_scheduler *sched,
+                                     uint64_t duration) {
+  if (sched->render_time == 0)
+    sched->render_time = duration;
+  else
+    sched->render_time = (7 * sched->render_time + duration) / 8;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Computes 50th and 99th percentiles of non zero samples.
+static void percentiles(const uint32_t *samples, uint64_t n_samples,
+                        uint64_t *p50, uint64_t *p99) {
+  uint32_t sorted[SINIT_STATS_LEN];
+  size_t n = 0;
+
+  if (n_samples > SINIT_STATS_LEN)
+    n_samples = SINIT_STATS_LEN;
+  for (size_t i = 0; i < n_samples; i++)
+    if (samples[i] != 0)
+      sorted[n++] = samples[i];
+
+  if (n == 0) {
+    *p50 = 0;
+    *p99 = 0;
+    return;
+  }
+
+  qsort(sorted, n, sizeof(*sorted), cmp_u32);
+  *p50 = sorted[n / 2];
+  *p99 = sorted[n * 99 / 100];
+}
+
+// Scales a surface-local length to buffer pixels, rounding half away from
+// zero as fractional scale protocol requires.
+static int scale_length(int length, uint32_t scale) {
+  return (length * scale + SINIT_SCALE_DENOMINATOR / 2) /
+         SINIT_SCALE_DENOMINATOR;
+}
+
+// Returns preferred buffer format of surface supported by compositor.
+static enum sinit_format surface_format(sinit_surface *surf) {
+  for (int i = 0; i < surf->base.n_formats; i++)
+    if (state.shm_formats & (1u << surf->base.formats[i]))
+      return surf->base.formats[i];
+  return SINIT_FORMAT_ARGB8888;
+}
+
+static void resize_surface(sinit_surface *surf, int width, int height,
+                           uint32_t scale) {
+  // Swapchain may be remapped.
+  render_pool_cancel(&state.render_pool, &surf->base.job);
+
+  // Without viewporter, buffer scale must be an integer.
+  if (surf->base.viewport == NULL)
+    scale = scale / SINIT_SCALE_DENOMINATOR * SINIT_SCALE_DENOMINATOR;
+  else
+    wp_viewport_set_destination(surf->base.viewport, width, height);
+
+  enum sinit_format format = surface_format(surf);
+  if (format != surf->base.swapchain.format)
+    LOG_DBG("surface buffer format %s", formats[format].name);
+  swapchain_resize(&surf->base.swapchain, scale_length(width, scale),
+                   scale_length(height, scale), format);
+  tiles_resize(&surf->base.tiles, surf->base.swapchain.width,
+               surf->base.swapchain.height);
+}
+
+// Creates fractional scale and viewport objects of surface if compositor
+// supports them.
+static void surface_init_scale(sinit_surface *surf) {
+  surf->base.scale = SINIT_SCALE_DENOMINATOR;
+  surf->base.fractional_scale = NULL;
+  surf->base.viewport = NULL;
+
+  if (state.fractional_scale_manager == NULL || state.viewporter == NULL)
+    return;
+
+  surf->base.viewport =
+      wp_viewporter_get_viewport(state.viewporter, surf->base.wl_surface);
+  surf->base.fractional_scale =
+      wp_fractional_scale_manager_v1_get_fractional_scale(
+          state.fractional_scale_manager, surf->base.wl_surface);
+  wp_fractional_scale_v1_add_listener(surf->base.fractional_scale,
+                                      &fractional_scale_listener, surf);
+}
+
+static void surface_deinit_scale(sinit_surface *surf) {
+  if (surf->base.fractional_scale != NULL)
+    wp_fractional_scale_v1_destroy(surf->base.fractional_scale);
+  if (surf->base.viewport != NULL)
+    wp_viewport_destroy(surf->base.viewport);
+  surf->base.fractional_scale = NULL;
+  surf->base.viewport = NULL;
+}
+
+static void init_wayland(struct sinit_state *s) {
+  s->display = wl_display_connect(NULL);
+  if (s->display == NULL)
+    LOG_FATAL("failed to connect to wayland display");
+
+  s->registry = wl_display_get_registry(s->display);
+  if (s->display == NULL)
+    LOG_FATAL("failed to get wayland registry");
+
+  wl_registry_add_listener(s->registry, &registry_listener, s);
+  if (wl_display_roundtrip(s->display) < 0)
+    LOG_FATAL("wl_display_roundtrip() failed");
+
+  // Receive initial state of bound globals (e.g. outputs).
+  if (wl_display_roundtrip(s->display) < 0)
+    LOG_FATAL("wl_display_roundtrip() failed");
+
+  if (s->compositor == NULL)
+    LOG_FATAL("wl_compositor is missing");
+  if (s->shell == NULL)
+    LOG_FATAL("no XDG shell interface");
+  if (s->shm == NULL)
+    LOG_FATAL("compositor doesn't support wl_shm");
+  if (s->presentation == NULL)
+    LOG_WARN("compositor doesn't support presentation time protocol, frames "
+             "won't be aligned on vblanks");
+  if (s->layer_shell == NULL)
+    LOG_FATAL("compositor doesn't support wlr layer shell protocol");
+
+  s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (s->epoll_fd < 0)
+    LOG_FATAL("failed to create epoll fd: %m");
+
+  s->display_source.fd = wl_display_get_fd(s->display);
+  s->display_source.dispatch = display_dispatch;
+  source_add(&s->display_source);
+}
+
+static void deinit_wayland(struct sinit_state *s) {
+  render_pool_stop(&s->render_pool);
+  tile_pool_stop(&s->tile_pool);
+  if (s->reading)
+    wl_display_cancel_read(s->display);
+  tll_foreach(s->outputs, it) {
+    output_destroy(it->item);
+    tll_remove(s->outputs, it);
+  }
+  tll_foreach(s->seats, it) {
+    seat_destroy(it->item);
+    tll_remove(s->seats, it);
+  }
+  if (s->cursor_shape_manager != NULL)
+    wp_cursor_shape_manager_v1_destroy(s->cursor_shape_manager);
+  if (s->xkb_context != NULL)
+    xkb_context_unref(s->xkb_context);
+  if (s->fractional_scale_manager != NULL)
+    wp_fractional_scale_manager_v1_destroy(s->fractional_scale_manager);
+  if (s->viewporter != NULL)
+    wp_viewporter_destroy(s->viewporter);
+  if (s->presentation != NULL)
+    wp_presentation_destroy(s->presentation);
+  // Globals may have been removed at runtime.
+  if (s->layer_shell != NULL)
+    zwlr_layer_shell_v1_destroy(s->layer_shell);
+  if (s->shell != NULL)
+    xdg_wm_base_destroy(s->shell);
+  if (s->shm != NULL)
+    wl_shm_destroy(s->shm);
+  wl_registry_destroy(s->registry);
+  if (s->subcompositor != NULL)
+    wl_subcompositor_destroy(s->subcompositor);
+  if (s->compositor != NULL)
+    wl_compositor_destroy(s->compositor);
+  tll_free(s->surfaces);
+  wl_display_disconnect(s->display);
+  close(s->epoll_fd);
+}
+
+/* Surface initialization public API */
+
+/**
+ * Initialize library state and connect to display server. This function panics
+ * if it failed to do so. Globals removed by the compositor afterward don't
+ * abort: surfaces depending on them are rebuilt in place once they are
+ * advertised again.
+ */
+void sinit_init(const char *app_id) {
+  state.app_id = app_id;
+  state.clock_id = CLOCK_MONOTONIC;
+  init_wayland(&state);
+}
+
+/**
+ * Process all incoming events and returns a non-negative integer on success and
+ * -1 on error.
+ */
+int sinit_run() {
+  if (sinit_prepare() < 0)
+    return -1;
+
+  struct pollfd pfd = {.fd = state.epoll_fd, .events = POLLIN};
+  if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+    return -1;
+
+  return sinit_dispatch_pending();
+}
+
+/**
+ * Returns file descriptor to poll on to detect new event. This is an epoll
+ * file descriptor watching Wayland connection and frame timers.
+ */
+int sinit_fd() { return state.epoll_fd; }
+
+/**
+ * Dispatches already queued events, prepares reading events from display
+ * and flushes requests. It returns 0 on success and -1 on error. Calling it
+ * multiple times before sinit_dispatch_pending() is allowed.
+ */
+int sinit_prepare() {
+  if (!state.reading) {
+    while (wl_display_prepare_read(state.display) != 0)
+      if (wl_display_dispatch_pending(state.display) < 0)
+        return -1;
+    state.reading = true;
+  }
+
+  // Globals surfaces depend on were advertised again.
+  if (state.rebuild)
+    surfaces_rebuild();
+
+  return sinit_flush();
+}
+
+/**
+ * Reads events available without blocking and dispatches them. It returns a
+ * non-negative integer on success and -1 on error.
+ */
+int sinit_dispatch_pending() {
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+
+  if (sinit_prepare() < 0)
+    return -1;
+
+  int n = epoll_wait(state.epoll_fd, events, ALEN(events), 0);
+  if (n < 0)
+    n = 0;
+
+  bool display_ready = false;
+  for (int i = 0; i < n; i++)
+    if (events[i].data.ptr == &state.display_source &&
+        events[i].events & ~(uint32_t)EPOLLOUT)
+      display_ready = true;
+
+  state.reading = false;
+  if (display_ready) {
+    if (wl_display_read_events(state.display) < 0)
+      return -1;
+  } else {
+    wl_display_cancel_read(state.display);
+  }
+
+  // A dispatch may deinitialize surfaces and remove their sources.
+  struct dispatch_batch batch = {events, n, state.batch};
+  state.batch = &batch;
+  for (int i = 0; i < n; i++) {
+    struct sinit_source *source = events[i].data.ptr;
+    if (source != NULL)
+      source->dispatch(source, events[i].events);
+  }
+  state.batch = batch.outer;
 
-void sinit_layer_surface_init(sinit_surface *surf, enum sinit_layer layer,
-                              enum sinit_anchor anchors, int exclusive,
-                              int width, int height, bool opaque,
-                              sinit_render_fn render, void *userdata) {
-  surf->base.type = SINIT_LAYER_SHELL_SURFACE;
-  surf->base.factor = 1;
+  return wl_display_dispatch_pending(state.display);
+}
+
+/**
+ * Flushes buffered requests to display. It returns 0 on success and -1 on
+ * error. If socket buffer is full, fd returned by sinit_fd() becomes ready
+ * once display is writable and sinit_dispatch_pending() flushes the rest.
+ */
+int sinit_flush() {
+  if (wl_display_flush(state.display) < 0) {
+    if (errno != EAGAIN)
+      return -1;
+    display_watch_output(true);
+    return 0;
+  }
+
+  display_watch_output(false);
+  return 0;
+}
+
+/**
+ * Enables or disables explicit huge pages (MFD_HUGETLB) for large buffers.
+ * Huge pages must be reserved by system administrator, regular pages are used
+ * as fallback. Disabled by default.
+ */
+void sinit_set_hugetlb(bool enabled) { state.hugetlb = enabled; }
+
+/**
+ * Sets number of worker threads rendering surfaces. Render functions of
+ * different surfaces then run in parallel while the thread dispatching events
+ * only attaches and commits rendered buffers. 0, the default, renders surfaces
+ * synchronously while dispatching events. This must be called before any
+ * surface is created.
+ */
+void sinit_set_render_threads(int n) {
+  render_pool_stop(&state.render_pool);
+  if (n > 0)
+    render_pool_start(&state.render_pool, n);
+}
+
+/**
+ * Sets number of worker threads rendering tiles of tiled surfaces in addition
+ * to the thread rendering the frame. 0, the default, renders tiles
+ * sequentially. This must be called before any surface is created.
+ */
+void sinit_set_tile_threads(int n) {
+  tile_pool_stop(&state.tile_pool);
+  if (n > 0)
+    tile_pool_start(&state.tile_pool, n);
+}
+
+/**
+ * Sets output hotplug listener. added is immediately called for all known
+ * outputs. Passing NULL removes current listener.
+ */
+void sinit_set_output_listener(const struct sinit_output_listener *listener,
+                               void *userdata) {
+  state.output_listener = listener;
+  state.output_listener_data = userdata;
+
+  if (listener == NULL || listener->added == NULL)
+    return;
+
+  tll_foreach(state.outputs, it) {
+    if (it->item->ready)
+      listener->added(it->item, userdata);
+  }
+}
+
+/**
+ * Deinitialize library state and free associated resources.
+ */
+void sinit_deinit() { deinit_wayland(&state); }
+
+/**
+ * Adds rectangle to damage. Rectangles are merged when it is cheaper than
+ * damaging both of them or when there is no room left.
+ */
+void sinit_damage_add(struct sinit_damage *damage, struct sinit_rect rect) {
+  damage_add(damage, rect);
+}
+
+/**
+ * Converts a surface-local length to buffer pixels at the given scale, the
+ * way sinit sizes buffers. Render functions must use it instead of rounding
+ * length * scale themselves, which can be off by one pixel at fractional
+ * scales.
+ */
+int sinit_scale_length(int length, double scale) {
+  // Scales are multiples of 1/SINIT_SCALE_DENOMINATOR.
+  return scale_length(length, scale * SINIT_SCALE_DENOMINATOR + 0.5);
+}
+
+/* Surface methods */
+
+bool sinit_surface_closed(sinit_surface *surf) { return surf->base.closed; }
+
+// Requests a frame callback if there is none.
+static void surface_frame(sinit_surface *surf) {
+  if (surf->base.wl_callback != NULL)
+    return;
+
+  surf->base.wl_callback = wl_surface_frame(surf->base.wl_surface);
+  wl_callback_add_listener(surf->base.wl_callback, &frame_listener, surf);
+
+  // Frame callback is double-buffered state, commit it unless a render will
+  // do it.
+  if (!surf->base.job.in_flight)
+    surface_commit(surf);
+}
+
+/**
+ * Requests a new frame. It is safe to call from the render function, even if
+ * it runs on a worker thread.
+ */
+void sinit_surface_request_frame(sinit_surface *surf) {
+  // Wayland objects of surface are owned by event loop thread, frame is
+  // requested once job is committed.
+  if (render_worker) {
+    surf->base.job.frame_requested = true;
+    return;
+  }
+
+  surf->base.dirty = true;
+
+  // Frame is requested once surface is shown.
+  if (surface_hidden(surf))
+    return;
+
+  // A frame is already scheduled.
+  if (surf->base.scheduler.armed)
+    return;
+
+  surface_frame(surf);
+}
+
+/**
+ * Enables or disables render-on-demand mode. In this mode, sinit only renders
+ * surface after sinit_surface_request_frame() or sinit_surface_invalidate()
+ * and when its size or scale changed, configure events alone don't trigger a
+ * render. Disabled by default.
+ */
+void sinit_surface_on_demand(sinit_surface *surf, bool enabled) {
+  surf->base.on_demand = enabled;
+}
+
+void sinit_surface_damage(sinit_surface *surf, int x, int y, int width,
+                          int height) {
+  struct sinit_swapchain *sc = &surf->base.swapchain;
+  damage_add(&surf->base.damage,
+             rect_clip((struct sinit_rect){x, y, width, height}, sc->width,
+                       sc->height));
+}
+
+bool sinit_surface_buffer_valid(sinit_surface *surf) {
+  return surf->base.buffer_valid;
+}
+
+void sinit_surface_frame_margin(sinit_surface *surf, uint64_t margin) {
+  surf->base.scheduler.margin = margin;
+}
+
+void sinit_surface_frame_stats(sinit_surface *surf,
+                               struct sinit_frame_stats *stats) {
+  struct sinit_frame_scheduler *sched = &surf->base.scheduler;
+
+  stats->presented = sched->presented;
+  stats->dropped = sched->dropped;
+  stats->missed = sched->missed;
+  stats->refresh = sched->refresh;
+  stats->render = sched->render_time;
+  percentiles(sched->frame_times, sched->presented, &stats->frame_time_p50,
+              &stats->frame_time_p99);
+  percentiles(sched->latencies, sched->presented, &stats->latency_p50,
+              &stats->latency_p99);
+}
+
+// Calls render function of job's surface. This may run on a worker thread.
+static void render_job_run(struct sinit_render_job *job) {
+  sinit_surface *surf = job->surface;
+
+  uint64_t start = clock_now(CLOCK_MONOTONIC);
+  if (surf->base.tiles.render != NULL)
+    tile_pool_run(&state.tile_pool, job);
+  else
+    surf->base.render(surf, job->buffer->data, job->width, job->height,
+                      job->buffer->stride, job->buffer->format, job->scale,
+                      job->time, surf->base.userdata);
+  job->duration = clock_now(CLOCK_MONOTONIC) - start;
+}
+
+// Attaches and commits buffer rendered by job.
+static void render_job_commit(struct sinit_render_job *job) {
+  sinit_surface *surf = job->surface;
+  struct sinit_buffer *buf = job->buffer;
+  uint32_t time = job->time;
+
+  job->in_flight = false;
+  job->done = false;
+  frame_scheduler_rendered(&surf->base.scheduler, job->duration);
+
+  // Render function didn't report damage or had to repaint everything.
+  if (surf->base.damage.n_rects == 0 || !surf->base.buffer_valid) {
+    surf->base.damage.rects[0] =
+        (struct sinit_rect){0, 0, buf->width, buf->height};
+    surf->base.damage.n_rects = 1;
+  }
+
+  wl_surface_attach(surf->base.wl_surface, buf->wl_buffer, 0, 0);
+  if (surf->base.viewport == NULL)
+    wl_surface_set_buffer_scale(surf->base.wl_surface,
+                                surf->base.scale / SINIT_SCALE_DENOMINATOR);
+  for (int i = 0; i < surf->base.damage.n_rects; i++) {
+    struct sinit_rect *r = &surf->base.damage.rects[i];
+    wl_surface_damage_buffer(surf->base.wl_surface, r->x, r->y, r->width,
+                             r->height);
+  }
+  frame_scheduler_feedback(&surf->base.scheduler, surf->base.wl_surface);
+  surface_commit(surf);
+  swapchain_present(&surf->base.swapchain, buf, &surf->base.damage);
+
+  surf->base.prev_render = time;
+
+  if (job->frame_requested) {
+    job->frame_requested = false;
+    sinit_surface_request_frame(surf);
+  }
+
+  // A frame was requested while this one was rendered.
+  if (surf->base.render_pending)
+    sinit_surface_render(surf, surf->base.pending_render);
+}
+
+/**
+ * Sets buffer formats render function supports in order of preference. The
+ * first one supported by the compositor is used, ARGB8888 if there is none.
+ * Defaults to XRGB8888 then ARGB8888 for opaque surfaces and ARGB8888
+ * otherwise. Formats without alpha channel must only be used by opaque
+ * surfaces. An empty list (n_formats <= 0) restores the defaults.
+ */
+void sinit_surface_formats(sinit_surface *surf,
+                           const enum sinit_format *formats, int n_formats) {
+  if (n_formats <= 0) {
+    // Surface is opaque if its whole area is.
+    surface_init_formats(surf, surf->base.opaque_region.full);
+  } else {
+    if (n_formats > SINIT_FORMAT_COUNT)
+      n_formats = SINIT_FORMAT_COUNT;
+    memcpy(surf->base.formats, formats, n_formats * sizeof(*formats));
+    surf->base.n_formats = n_formats;
+  }
+
+  // Apply format to already configured surface.
+  struct sinit_swapchain *sc = &surf->base.swapchain;
+  if (sc->width > 0 && sc->format != surface_format(surf)) {
+    resize_surface(surf, surf->base.config.width, surf->base.config.height,
+                   surf->base.scale);
+    sinit_surface_request_frame(surf);
+  }
+}
+
+/**
+ * Returns name of the given format.
+ */
+const char *sinit_format_name(enum sinit_format format) {
+  return formats[format].name;
+}
+
+/**
+ * Sets opaque region of surface, a list of rectangles in surface-local
+ * coordinates. Compositor can skip blending what lies under it. Passing NULL
+ * marks the entire surface opaque whatever its size. Rectangles beyond
+ * SINIT_REGION_MAX_RECTS are ignored. Region is sent on next commit if it
+ * changed.
+ */
+void sinit_surface_opaque_region(sinit_surface *surf,
+                                 const struct sinit_rect *rects, int n_rects) {
+  region_set(&surf->base.opaque_region, rects, n_rects, false);
+}
+
+/**
+ * Sets input region of surface, a list of rectangles in surface-local
+ * coordinates. Input events outside of it go to surfaces below. Passing NULL
+ * makes the entire surface accept input, the default. Rectangles beyond
+ * SINIT_REGION_MAX_RECTS are merged with the last one. Region is sent on next
+ * commit if it changed.
+ */
+void sinit_surface_input_region(sinit_surface *surf,
+                                const struct sinit_rect *rects, int n_rects) {
+  region_set(&surf->base.input_region, rects, n_rects, true);
+}
+
+/**
+ * Switches surface to tiled rendering. Buffer is split in tile_size pixels
+ * large square tiles (SINIT_DEFAULT_TILE_SIZE if 0) and render is called for
+ * each tile invalidated since the previous frame, tiles are distributed
+ * across tile threads. Surface damage is derived from rendered tiles,
+ * sinit_surface_damage() must not be used. Frames without dirty tiles are
+ * skipped.
+ */
+void sinit_surface_tiled(sinit_surface *surf, sinit_tile_render_fn render,
+                         int tile_size) {
+  render_pool_cancel(&state.render_pool, &surf->base.job);
+
+  struct sinit_tiles *t = &surf->base.tiles;
+  t->render = render;
+  t->size = tile_size > 0 ? tile_size : SINIT_DEFAULT_TILE_SIZE;
+  tiles_resize(t, surf->base.swapchain.width, surf->base.swapchain.height);
+}
+
+/**
+ * Marks tiles intersecting given rectangle, in buffer coordinates, dirty. They
+ * will be rendered on next frame, which is requested in render-on-demand mode.
+ * This must not be called from the render function.
+ */
+void sinit_surface_invalidate(sinit_surface *surf, int x, int y, int width,
+                              int height) {
+  struct sinit_tiles *t = &surf->base.tiles;
+  if (t->render == NULL)
+    return;
+
+  struct sinit_swapchain *sc = &surf->base.swapchain;
+  struct sinit_rect r = rect_clip((struct sinit_rect){x, y, width, height},
+                                  sc->width, sc->height);
+  if (rect_area(r) == 0)
+    return;
+
+  for (int row = r.y / t->size; row <= (r.y + r.height - 1) / t->size; row++) {
+    for (int col = r.x / t->size; col <= (r.x + r.width - 1) / t->size;
+         col++) {
+      int i = row * t->cols + col;
+      t->dirty[i / 64] |= 1ull << (i % 64);
+    }
+  }
+
+  if (surf->base.on_demand)
+    sinit_surface_request_frame(surf);
+}
+
+static void sinit_surface_render(sinit_surface *surf, uint32_t time) {
+  if (surf->base.closed || surf->base.lost)
+    return;
+
+  struct sinit_render_job *job = &surf->base.job;
+  struct sinit_tiles *tiles = &surf->base.tiles;
+  struct sinit_swapchain *sc = &surf->base.swapchain;
+
+  // Apply configure events received since last frame.
+  if (!job->in_flight)
+    surface_flush_configure(surf);
+
+  // Nothing changed since front buffer was rendered.
+  if (tiles->render != NULL && !job->in_flight && !tiles_dirty(tiles) &&
+      sc->front != NULL && sc->front->frame != 0 &&
+      sc->front->width == sc->width && sc->front->height == sc->height) {
+    surf->base.render_pending = false;
+    return;
+  }
+
+  struct sinit_buffer *buf = NULL;
+  if (!job->in_flight)
+    buf = swapchain_acquire(&surf->base.swapchain);
+  if (buf == NULL) {
+    LOG_DBG("surface %p is busy, delaying render", (void *)surf);
+    surf->base.render_pending = true;
+    surf->base.pending_render = time;
+    return;
+  }
+  surf->base.render_pending = false;
+  // Requests made from now on need another frame.
+  surf->base.dirty = false;
+
+  surf->base.damage.n_rects = 0;
+  surf->base.buffer_valid =
+      swapchain_copy_forward(&surf->base.swapchain, buf);
+  if (tiles->render != NULL)
+    tiles_collect(tiles, !surf->base.buffer_valid, &surf->base.damage,
+                  buf->width, buf->height);
+
+  job->buffer = buf;
+  job->width = surf->base.config.width;
+  job->height = surf->base.config.height;
+  job->scale = (double)surf->base.scale / SINIT_SCALE_DENOMINATOR;
+  job->time = time;
+  job->in_flight = true;
+
+  if (state.render_pool.n_threads > 0) {
+    render_pool_submit(&state.render_pool, job);
+    return;
+  }
+
+  render_job_run(job);
+  render_job_commit(job);
+}
+
+/**
+ * Sets input function of surface, NULL, the default, ignores input events.
+ * userdata of surface is passed to it. This must be called after surface is
+ * initialized.
+ */
+void sinit_surface_input(sinit_surface *surf, sinit_input_fn input) {
+  surf->base.input = input;
+}
+
+/**
+ * Sets cursor displayed while pointer is over surface. Cursors are set using
+ * the cursor shape protocol, compositor picks the cursor if it doesn't
+ * support it.
+ */
+void sinit_surface_cursor(sinit_surface *surf, enum sinit_cursor cursor) {
+  if (surf->base.cursor == cursor)
+    return;
+
+  surf->base.cursor = cursor;
+  tll_foreach(state.seats, it) {
+    if (it->item->pointer_focus == surf)
+      seat_set_cursor(it->item);
+  }
+}
+
+// Initializes state common to all surface types.
+static void surface_init(sinit_surface *surf, enum sinit_surface_type type,
+                         bool opaque, sinit_render_fn render, void *userdata) {
+  surf->base.type = type;
   surf->base.render = render;
   surf->base.userdata = userdata;
+  surf->base.wl_surface = NULL;
+  surf->base.wl_callback = NULL;
+  surf->base.lost = true;
   surf->base.closed = false;
-  surf->base.config.width = width;
-  surf->base.config.height = height;
+  surf->base.render_pending = false;
+  surf->base.prev_render = 0;
+  surf->base.n_outputs = 0;
+  surf->base.offscreen = false;
+  surf->base.suspended = false;
+  surf->base.on_demand = false;
+  surf->base.dirty = false;
+  surf->base.input = NULL;
+  surf->base.cursor = SINIT_CURSOR_DEFAULT;
+  surf->base.job = (struct sinit_render_job){.surface = surf};
+  surf->base.tiles = (struct sinit_tiles){0};
+  surface_init_regions(surf, opaque);
+  surface_init_formats(surf, opaque);
+  swapchain_init(&surf->base.swapchain, surf);
+  frame_scheduler_init(&surf->base.scheduler, surf);
+  tll_push_back(state.surfaces, surf);
+}
 
-  // Wayland surface.
-  surf->base.wl_surface = wl_compositor_create_surface(state.compositor);
-  wl_surface_add_listener(surf->base.wl_surface, &surface_listener, surf);
-  surf->layer.layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-      state.layer_shell, surf->base.wl_surface, NULL, layer, "");
-  if (anchors != 0)
-    zwlr_layer_surface_v1_set_anchor(surf->layer.layer_surface,
-                                     (anchors & 0xF) | (anchors >> 4));
-  if (anchors >= SINIT_ANCHOR_TOP_EXCLUSIVE)
-    zwlr_layer_surface_v1_set_exclusive_zone(surf->layer.layer_surface,
-                                             anchors >> 4);
-  if (exclusive)
-    zwlr_layer_surface_v1_set_exclusive_zone(surf->layer.layer_surface,
-                                             exclusive);
-  zwlr_layer_surface_v1_set_size(surf->layer.layer_surface, width, height);
-  zwlr_layer_surface_v1_add_listener(surf->layer.layer_surface,
-                                     &layer_surface_listener, surf);
+static void xdg_surface_create(sinit_surface *surf) {
+  surf->xdg.pending_suspended = false;
+  surf->xdg.configure_pending = false;
+  surf->xdg.xdg_surface =
+      xdg_wm_base_get_xdg_surface(state.shell, surf->base.wl_surface);
+  xdg_surface_add_listener(surf->xdg.xdg_surface, &xdg_surface_listener, surf);
+  surf->xdg.xdg_toplevel = xdg_surface_get_toplevel(surf->xdg.xdg_surface);
+  xdg_toplevel_add_listener(surf->xdg.xdg_toplevel, &xdg_toplevel_listener,
+                            surf);
 
-  if (opaque) {
-    surf->base.region = wl_compositor_create_region(state.compositor);
-    wl_region_add(surf->base.region, 0, 0, width, height);
-    wl_surface_set_opaque_region(surf->base.wl_surface, surf->base.region);
-  }
+  xdg_toplevel_set_app_id(surf->xdg.xdg_toplevel, state.app_id);
 
   // Commit surface.
-  wl_surface_commit(surf->base.wl_surface);
+  surface_commit(surf);
 }
 
-void sinit_layer_surface_margin(sinit_surface *surf, int top, int right,
-                                int bottom, int left) {
-  zwlr_layer_surface_v1_set_margin(surf->layer.layer_surface, top, right,
-                                   bottom, left);
+static void layer_surface_create(sinit_surface *surf) {
+  struct sinit_layer_surface *layer = &surf->layer;
+  struct sinit_output *output = layer->output;
+
+  layer->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+      state.layer_shell, surf->base.wl_surface,
+      output != NULL ? output->wl_output : NULL, layer->layer, "");
+
+  // Use output scale until compositor sends a preferred one.
+  if (output != NULL)
+    surf->base.scale = output->scale * SINIT_SCALE_DENOMINATOR;
+  if (layer->anchors != 0)
+    zwlr_layer_surface_v1_set_anchor(layer->layer_surface,
+                                     (layer->anchors & 0xF) |
+                                         (layer->anchors >> 4));
+  if (layer->anchors >= SINIT_ANCHOR_TOP_EXCLUSIVE)
+    zwlr_layer_surface_v1_set_exclusive_zone(layer->layer_surface,
+                                             layer->anchors >> 4);
+  if (layer->exclusive)
+    zwlr_layer_surface_v1_set_exclusive_zone(layer->layer_surface,
+                                             layer->exclusive);
+  zwlr_layer_surface_v1_set_margin(layer->layer_surface, layer->margin_top,
+                                   layer->margin_right, layer->margin_bottom,
+                                   layer->margin_left);
+  zwlr_layer_surface_v1_set_size(layer->layer_surface, layer->width,
+                                 layer->height);
+  zwlr_layer_surface_v1_add_listener(layer->layer_surface,
+                                     &layer_surface_listener, surf);
+
+  // Commit surface.
+  surface_commit(surf);
 }
 
-void sinit_layer_surface_deinit(sinit_surface *surf) {
-  // Destroy Wayland resources.
+static void subsurface_create(sinit_surface *surf);
+
+// Returns whether globals surface needs are bound.
+static bool surface_can_create(sinit_surface *surf) {
+  if (state.compositor == NULL || state.shm == NULL)
+    return false;
+
+  switch (surf->base.type) {
+  case SINIT_XDG_TOP_LEVEL_SURFACE:
+    return state.shell != NULL;
+  case SINIT_LAYER_SHELL_SURFACE:
+    return state.layer_shell != NULL;
+  case SINIT_SUBSURFACE:
+    return state.subcompositor != NULL && !surf->sub.parent->base.lost;
+  default:
+    return false;
+  }
+}
+
+// Creates Wayland objects of a lost surface, swapchain buffers are created
+// on first render. It returns false if required globals are missing.
+static bool surface_create(sinit_surface *surf) {
+  if (!surface_can_create(surf))
+    return false;
+
+  surf->base.lost = false;
+  surf->base.wl_surface = wl_compositor_create_surface(state.compositor);
+  wl_surface_add_listener(surf->base.wl_surface, &surface_listener, surf);
+  surface_init_scale(surf);
+
+  switch (surf->base.type) {
+  case SINIT_XDG_TOP_LEVEL_SURFACE:
+    xdg_surface_create(surf);
+    break;
+  case SINIT_LAYER_SHELL_SURFACE:
+    layer_surface_create(surf);
+    break;
+  case SINIT_SUBSURFACE:
+    subsurface_create(surf);
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+// Destroys Wayland objects and buffers of surface, leaving it lost until
+// surface_create() is called again. User state (size, regions, tiles...) is
+// kept.
+static void surface_destroy(sinit_surface *surf) {
+  // Frames requested from now on wait for surface to be created again.
+  surf->base.lost = true;
+  render_pool_cancel(&state.render_pool, &surf->base.job);
+  seats_forget_surface(surf);
+
   if (surf->base.wl_callback != NULL)
     wl_callback_destroy(surf->base.wl_callback);
-  if (surf->base.wl_buffer != NULL) {
-    wl_buffer_destroy(surf->base.wl_buffer);
-    munmap(surf->base.buffer,
-           surf->base.config.width * surf->base.config.height * 4);
+  surf->base.wl_callback = NULL;
+  swapchain_deinit(&surf->base.swapchain);
+  swapchain_init(&surf->base.swapchain, surf);
+  surface_deinit_scale(surf);
+  frame_scheduler_drop_feedbacks(&surf->base.scheduler);
+
+  switch (surf->base.type) {
+  case SINIT_XDG_TOP_LEVEL_SURFACE:
+    if (surf->xdg.xdg_toplevel != NULL)
+      xdg_toplevel_destroy(surf->xdg.xdg_toplevel);
+    if (surf->xdg.xdg_surface != NULL)
+      xdg_surface_destroy(surf->xdg.xdg_surface);
+    surf->xdg.xdg_toplevel = NULL;
+    surf->xdg.xdg_surface = NULL;
+    // Keep current size across rebuilds.
+    surf->xdg.pending_config = surf->base.config;
+    break;
+  case SINIT_LAYER_SHELL_SURFACE:
+    if (surf->layer.layer_surface != NULL)
+      zwlr_layer_surface_v1_destroy(surf->layer.layer_surface);
+    surf->layer.layer_surface = NULL;
+    break;
+  case SINIT_SUBSURFACE:
+    if (surf->sub.subsurface != NULL)
+      wl_subsurface_destroy(surf->sub.subsurface);
+    surf->sub.subsurface = NULL;
+    break;
+  default:
+    break;
   }
-  if (surf->layer.layer_surface != NULL)
-    zwlr_layer_surface_v1_destroy(surf->layer.layer_surface);
-  if (surf->base.region != NULL)
-    wl_region_destroy(surf->base.region);
+
   if (surf->base.wl_surface != NULL)
     wl_surface_destroy(surf->base.wl_surface);
+  surf->base.wl_surface = NULL;
+
+  // Next configure is handled as the first one.
+  surf->base.prev_render = 0;
+  surf->base.n_outputs = 0;
+  surf->base.offscreen = false;
+  surf->base.suspended = false;
+}
+
+// Destroys surface and releases resources common to all surface types.
+static void surface_deinit(sinit_surface *surf) {
+  surface_destroy(surf);
+  tiles_deinit(&surf->base.tiles);
+  frame_scheduler_deinit(&surf->base.scheduler);
+  tll_foreach(state.surfaces, it) {
+    if (it->item == surf)
+      tll_remove(state.surfaces, it);
+  }
 
   surf->base.type = SINIT_RAW_SURFACE;
 }
+
+// Destroys Wayland objects of surfaces of the given type, all surfaces if
+// type is SINIT_RAW_SURFACE, and of their subsurfaces. They are created again
+// by surfaces_rebuild() once globals they depend on are back.
+static void surfaces_destroy(enum sinit_surface_type type) {
+  // Parents are older than their subsurfaces and come first.
+  tll_foreach(state.surfaces, it) {
+    sinit_surface *surf = it->item;
+    if (surf->base.lost)
+      continue;
+
+    if (type == SINIT_RAW_SURFACE || surf->base.type == type ||
+        (surf->base.type == SINIT_SUBSURFACE && surf->sub.parent->base.lost))
+      surface_destroy(surf);
+  }
+  state.rebuild = true;
+}
+
+// Destroys fractional scale and viewport objects of surfaces and resizes
+// their buffers in place to the closest integer scale above.
+static void surfaces_drop_fractional_scale(void) {
+  tll_foreach(state.surfaces, it) {
+    sinit_surface *surf = it->item;
+    if (surf->base.lost)
+      continue;
+
+    surface_deinit_scale(surf);
+    uint32_t scale = (surf->base.scale + SINIT_SCALE_DENOMINATOR - 1) /
+                     SINIT_SCALE_DENOMINATOR * SINIT_SCALE_DENOMINATOR;
+    if (surf->base.prev_render != 0)
+      resize_surface(surf, surf->base.config.width, surf->base.config.height,
+                     scale);
+    surf->base.scale = scale;
+
+    // Buffer scale is set on next commit, even if scale didn't change.
+    sinit_surface_request_frame(surf);
+  }
+}
+
+// Creates lost surfaces whose globals are available again. Parents are
+// created before their subsurfaces as they are older.
+static void surfaces_rebuild(void) {
+  uint64_t start = clock_now(CLOCK_MONOTONIC);
+  int n_rebuilt = 0;
+  state.rebuild = false;
+
+  tll_foreach(state.surfaces, it) {
+    sinit_surface *surf = it->item;
+    if (!surf->base.lost || surf->base.closed)
+      continue;
+
+    if (surface_create(surf)) {
+      n_rebuilt++;
+      // Content must be rendered again whatever render mode.
+      surf->base.dirty = true;
+      tiles_invalidate_all(&surf->base.tiles);
+    } else {
+      state.rebuild = true;
+    }
+  }
+
+  if (n_rebuilt > 0)
+    LOG_INFO("rebuilt %d surfaces in %lluus", n_rebuilt,
+             (unsigned long long)(clock_now(CLOCK_MONOTONIC) - start) / 1000);
+}
+
+/* XDG Shell surface methods */
+
+void sinit_xdg_surface_init(sinit_surface *surf, int width, int height,
+                            bool opaque, sinit_render_fn render,
+                            void *userdata) {
+  surface_init(surf, SINIT_XDG_TOP_LEVEL_SURFACE, opaque, render, userdata);
+  surf->xdg.xdg_surface = NULL;
+  surf->xdg.xdg_toplevel = NULL;
+  surf->xdg.pending_config.width = width;
+  surf->xdg.pending_config.height = height;
+
+  if (!surface_create(surf))
+    LOG_WARN("surface globals are missing, surface will be created once "
+             "they are advertised");
+}
+
+void sinit_xdg_toplevel_surface_deinit(sinit_surface *surf) {
+  surface_deinit(surf);
+}
+
+/* Layer shell surface */
+
+void sinit_layer_surface_init(sinit_surface *surf, struct sinit_output *output,
+                              enum sinit_layer layer, enum sinit_anchor anchors,
+                              int exclusive, int width, int height, bool opaque,
+                              sinit_render_fn render, void *userdata) {
+  surface_init(surf, SINIT_LAYER_SHELL_SURFACE, opaque, render, userdata);
+  surf->base.config.width = width;
+  surf->base.config.height = height;
+  surf->layer.layer_surface = NULL;
+  surf->layer.output = output;
+  surf->layer.layer = layer;
+  surf->layer.anchors = anchors;
+  surf->layer.exclusive = exclusive;
+  surf->layer.width = width;
+  surf->layer.height = height;
+  surf->layer.margin_top = 0;
+  surf->layer.margin_right = 0;
+  surf->layer.margin_bottom = 0;
+  surf->layer.margin_left = 0;
+
+  if (!surface_create(surf))
+    LOG_WARN("surface globals are missing, surface will be created once "
+             "they are advertised");
+}
+
+void sinit_layer_surface_margin(sinit_surface *surf, int top, int right,
+                                int bottom, int left) {
+  surf->layer.margin_top = top;
+  surf->layer.margin_right = right;
+  surf->layer.margin_bottom = bottom;
+  surf->layer.margin_left = left;
+  if (surf->layer.layer_surface != NULL)
+    zwlr_layer_surface_v1_set_margin(surf->layer.layer_surface, top, right,
+                                     bottom, left);
+}
+
+void sinit_layer_surface_deinit(sinit_surface *surf) { surface_deinit(surf); }
+
+/* Subsurface */
+
+// Commits parent so that subsurface state it holds (creation and position)
+// is applied. An in flight render commits it anyway.
+static void subsurface_commit_parent(sinit_surface *surf) {
+  sinit_surface *parent = surf->sub.parent;
+  if (!parent->base.lost && !parent->base.job.in_flight)
+    surface_commit(parent);
+}
+
+static void subsurface_create(sinit_surface *surf) {
+  sinit_surface *parent = surf->sub.parent;
+
+  surf->sub.subsurface = wl_subcompositor_get_subsurface(
+      state.subcompositor, surf->base.wl_surface, parent->base.wl_surface);
+  wl_subsurface_set_position(surf->sub.subsurface, surf->sub.x, surf->sub.y);
+  // Commits of subsurface don't wait for parent ones.
+  wl_subsurface_set_desync(surf->sub.subsurface);
+  subsurface_commit_parent(surf);
+
+  // Use parent scale until compositor sends a preferred one.
+  surf->base.scale = parent->base.scale;
+
+  // Subsurfaces have no configure sequence, render first frame right away.
+  resize_surface(surf, surf->base.config.width, surf->base.config.height,
+                 surf->base.scale);
+  surface_configured(surf, true);
+}
+
+void sinit_subsurface_init(sinit_surface *surf, sinit_surface *parent, int x,
+                           int y, int width, int height, bool opaque,
+                           sinit_render_fn render, void *userdata) {
+  surface_init(surf, SINIT_SUBSURFACE, opaque, render, userdata);
+  surf->base.config.width = width;
+  surf->base.config.height = height;
+  surf->sub.subsurface = NULL;
+  surf->sub.parent = parent;
+  surf->sub.x = x;
+  surf->sub.y = y;
+
+  if (!surface_create(surf))
+    LOG_WARN("surface globals are missing, surface will be created once "
+             "they are advertised");
+}
+
+void sinit_subsurface_position(sinit_surface *surf, int x, int y) {
+  surf->sub.x = x;
+  surf->sub.y = y;
+  if (surf->sub.subsurface == NULL)
+    return;
+
+  wl_subsurface_set_position(surf->sub.subsurface, x, y);
+  subsurface_commit_parent(surf);
+}
+
+void sinit_subsurface_resize(sinit_surface *surf, int width, int height) {
+  if (surf->base.config.width == width && surf->base.config.height == height)
+    return;
+
+  surf->base.config.width = width;
+  surf->base.config.height = height;
+  if (surf->base.lost)
+    return;
+
+  resize_surface(surf, width, height, surf->base.scale);
+  surface_configured(surf, true);
+}
+
+void sinit_subsurface_deinit(sinit_surface *surf) { surface_deinit(surf); }
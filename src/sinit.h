@@ -11,7 +11,9 @@
 #include <wayland-client.h>
 
 #include "stable/presentation-time/presentation-time.h"
+#include "stable/viewporter/viewporter.h"
 #include "stable/xdg-shell/xdg-shell.h"
+#include "staging/fractional-scale/fractional-scale-v1.h"
 #include "wlr/unstable/wlr-layer-shell-unstable-v1.h"
 
 /**
@@ -20,11 +22,521 @@
  * Wayland only.
  */
 
-typedef struct sinit_surface sinit_surface;
+typedef union sinit_surface sinit_surface;
 
+/**
+ * Pixel formats of surface buffers, in little-endian order of wl_shm. Only
+ * ARGB8888 and XRGB8888 are guaranteed to be supported by the compositor.
+ * sinit_draw kernels work on 32 bits xRGB formats only.
+ */
+enum sinit_format {
+  SINIT_FORMAT_ARGB8888,
+  SINIT_FORMAT_XRGB8888,
+  SINIT_FORMAT_RGB565,
+  SINIT_FORMAT_ABGR2101010,
+  SINIT_FORMAT_COUNT,
+};
+
+/**
+ * Render function of a surface. width and height are in surface-local
+ * coordinates while buffer is sinit_scale_length(width, scale) x
+ * sinit_scale_length(height, scale) pixels large. stride is the length of a
+ * buffer row in bytes.
+ */
 typedef void (*sinit_render_fn)(sinit_surface *surf, void *buf, int width,
-                                int height, int scale, uint32_t time,
-                                void *userdata);
+                                int height, int stride,
+                                enum sinit_format format, double scale,
+                                uint32_t time, void *userdata);
+
+/**
+ * Denominator of surface scales, fractional scales are multiples of
+ * 1/SINIT_SCALE_DENOMINATOR.
+ */
+#define SINIT_SCALE_DENOMINATOR 120
+
+/**
+ * Number of buffers in a surface swapchain. Three buffers let us render a new
+ * frame while the compositor holds both the displayed buffer and the pending
+ * one.
+ */
+#define SINIT_SWAPCHAIN_LEN 3
+
+/**
+ * Number of frames buffers of a swapchain must stay at most half as large as
+ * their slots before memory of unused parts of slots is released.
+ */
+#define SINIT_SWAPCHAIN_TRIM_FRAMES 60
+
+/**
+ * Size of explicit huge pages used for large shm pools.
+ */
+#define SINIT_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Minimum size of a shm pool to be backed by huge pages, smaller pools would
+ * waste most of a huge page.
+ */
+#define SINIT_HUGEPAGE_THRESHOLD SINIT_HUGEPAGE_SIZE
+
+/**
+ * Maximum number of damage rectangles tracked per frame. Rectangles are merged
+ * once this limit is reached.
+ */
+#define SINIT_DAMAGE_MAX_RECTS 8
+
+/**
+ * Maximum number of rectangles of an opaque or input region.
+ */
+#define SINIT_REGION_MAX_RECTS 16
+
+/**
+ * Maximum number of presentation feedbacks in flight per surface.
+ */
+#define SINIT_FEEDBACK_LEN 4
+
+/**
+ * Number of presented frames used to compute frame statistics.
+ */
+#define SINIT_STATS_LEN 128
+
+/**
+ * Default time, in nanoseconds, between the end of a render and the predicted
+ * vblank.
+ */
+#define SINIT_DEFAULT_FRAME_MARGIN_NS (4 * 1000 * 1000)
+
+/**
+ * Default size, in pixels, of the square tiles of a tiled surface.
+ */
+#define SINIT_DEFAULT_TILE_SIZE 256
+
+/**
+ * Maximum number of input events delivered at once. A pointer or touch frame
+ * with more events is delivered in several batches.
+ */
+#define SINIT_INPUT_BATCH_LEN 32
+
+/**
+ * Maximum number of simultaneous touch points per seat, extra points are
+ * ignored.
+ */
+#define SINIT_TOUCH_POINTS 10
+
+struct sinit_surface_config {
+  int width;
+  int height;
+};
+
+/**
+ * An output (e.g. a monitor) advertised by the compositor. Fields are updated
+ * atomically before output listener is called.
+ */
+struct sinit_output {
+  struct wl_output *wl_output;
+  uint32_t global;
+
+  // Output name (e.g. "DP-1") and human readable description, may be NULL.
+  char *name;
+  char *description;
+
+  // Position in compositor space and size of current mode in pixels.
+  int x;
+  int y;
+  int width;
+  int height;
+  // Refresh rate of current mode in mHz.
+  int refresh;
+  int scale;
+
+  // Output received its initial state.
+  bool ready;
+
+  // Free for use by library user.
+  void *userdata;
+};
+
+/**
+ * Output hotplug listener. added is called once an output received its
+ * initial state, changed when its state (e.g. scale or mode) is updated and
+ * removed right before output is freed.
+ */
+struct sinit_output_listener {
+  void (*added)(struct sinit_output *output, void *userdata);
+  void (*changed)(struct sinit_output *output, void *userdata);
+  void (*removed)(struct sinit_output *output, void *userdata);
+};
+
+/**
+ * A file descriptor polled by sinit event loop.
+ */
+struct sinit_source {
+  int fd;
+  void (*dispatch)(struct sinit_source *source, uint32_t events);
+};
+
+/**
+ * Frame statistics of a surface. Durations are in nanoseconds, percentiles
+ * are computed over the last SINIT_STATS_LEN presented frames.
+ */
+struct sinit_frame_stats {
+  // Number of frames presented, discarded by the compositor and presented
+  // later than the vblank following their commit.
+  uint64_t presented;
+  uint64_t dropped;
+  uint64_t missed;
+
+  // Refresh interval of output surface was last presented on, 0 if unknown.
+  uint64_t refresh;
+  // Average duration of render function.
+  uint64_t render;
+
+  // Time between two presented frames.
+  uint64_t frame_time_p50;
+  uint64_t frame_time_p99;
+
+  // Time between commit and presentation.
+  uint64_t latency_p50;
+  uint64_t latency_p99;
+};
+
+/**
+ * A rectangle in buffer coordinates.
+ */
+struct sinit_rect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+/**
+ * Render function of a tiled surface, called once per dirty tile and possibly
+ * concurrently for different tiles. buf points to the top-left pixel of tile
+ * and stride is the length of a buffer row in bytes. tile is in buffer
+ * coordinates.
+ */
+typedef void (*sinit_tile_render_fn)(sinit_surface *surf, void *buf,
+                                     int stride, enum sinit_format format,
+                                     struct sinit_rect tile, double scale,
+                                     uint32_t time, void *userdata);
+
+/**
+ * Damaged area of a frame, a list of possibly overlapping rectangles.
+ */
+struct sinit_damage {
+  struct sinit_rect rects[SINIT_DAMAGE_MAX_RECTS];
+  int n_rects;
+};
+
+/**
+ * An opaque or input region of a surface in surface-local coordinates.
+ */
+struct sinit_region {
+  struct sinit_rect rects[SINIT_REGION_MAX_RECTS];
+  int n_rects;
+  // Region covers the entire surface whatever its size.
+  bool full;
+};
+
+/**
+ * Types of input events.
+ */
+enum sinit_input_type {
+  SINIT_POINTER_ENTER,
+  SINIT_POINTER_LEAVE,
+  SINIT_POINTER_MOTION,
+  SINIT_POINTER_BUTTON,
+  SINIT_POINTER_SCROLL,
+  SINIT_KEYBOARD_ENTER,
+  SINIT_KEYBOARD_LEAVE,
+  SINIT_KEY,
+  SINIT_MODIFIERS,
+  SINIT_TOUCH_DOWN,
+  SINIT_TOUCH_UP,
+  SINIT_TOUCH_MOTION,
+  SINIT_TOUCH_CANCEL,
+};
+
+/**
+ * Keyboard modifier bit flags.
+ */
+enum sinit_modifier {
+  SINIT_MOD_SHIFT = 1,
+  SINIT_MOD_CTRL = 2,
+  SINIT_MOD_ALT = 4,
+  SINIT_MOD_LOGO = 8,
+  SINIT_MOD_CAPS_LOCK = 16,
+  SINIT_MOD_NUM_LOCK = 32,
+};
+
+/**
+ * An input event. Positions and scroll distances are in surface-local
+ * coordinates, fields that don't apply to the event type are zero.
+ */
+struct sinit_input_event {
+  enum sinit_input_type type;
+  // Timestamp in milliseconds, zero for enter and leave events.
+  uint32_t time;
+
+  // Pointer or touch point position.
+  double x;
+  double y;
+  // Touch point identifier.
+  int32_t id;
+
+  // Linux input code (e.g. BTN_LEFT or KEY_A) of button and key events and
+  // whether button or key was pressed or released.
+  uint32_t code;
+  bool pressed;
+
+  // Scroll distance and, for wheels, number of steps in 1/120 units.
+  double scroll_x;
+  double scroll_y;
+  int32_t steps_x;
+  int32_t steps_y;
+
+  // XKB keysym and NUL-terminated UTF-8 text of key events, text is empty
+  // when key doesn't produce any or is released.
+  uint32_t keysym;
+  char text[8];
+
+  // enum sinit_modifier bit set of keyboard events.
+  uint32_t modifiers;
+};
+
+/**
+ * Input function of a surface. Events are delivered in batches, a batch
+ * holds all the events of a wl_pointer or wl_touch frame that target surface
+ * and a single keyboard event otherwise. Consecutive motion and scroll events
+ * of a frame are merged.
+ */
+typedef void (*sinit_input_fn)(sinit_surface *surf,
+                               const struct sinit_input_event *events,
+                               int n_events, void *userdata);
+
+/**
+ * Pointer cursors, they are drawn by the compositor.
+ */
+enum sinit_cursor {
+  SINIT_CURSOR_DEFAULT,
+  SINIT_CURSOR_POINTER,
+  SINIT_CURSOR_TEXT,
+  SINIT_CURSOR_CROSSHAIR,
+  SINIT_CURSOR_WAIT,
+  SINIT_CURSOR_GRAB,
+  SINIT_CURSOR_GRABBING,
+  SINIT_CURSOR_NOT_ALLOWED,
+  SINIT_CURSOR_EW_RESIZE,
+  SINIT_CURSOR_NS_RESIZE,
+  SINIT_CURSOR_COUNT,
+};
+
+enum sinit_surface_type {
+  SINIT_RAW_SURFACE,
+  SINIT_XDG_TOP_LEVEL_SURFACE,
+  SINIT_LAYER_SHELL_SURFACE,
+  SINIT_SUBSURFACE,
+};
+
+/**
+ * A wl_buffer carved out of a swapchain shared memory pool.
+ */
+struct sinit_buffer {
+  struct sinit_swapchain *swapchain;
+  struct wl_buffer *wl_buffer;
+  void *data;
+  size_t offset;
+  int width;
+  int height;
+  int stride;
+  enum sinit_format format;
+  // Buffer is held by the compositor until it sends wl_buffer.release.
+  bool busy;
+  // Swapchain frame last rendered into this buffer, 0 if content is
+  // undefined.
+  uint64_t frame;
+};
+
+/**
+ * An in flight wp_presentation_feedback.
+ */
+struct sinit_feedback {
+  struct sinit_frame_scheduler *scheduler;
+  struct wp_presentation_feedback *feedback;
+  uint64_t commit_time;
+};
+
+/**
+ * Frame scheduler of a surface. It predicts next vblank using presentation
+ * feedback and delays rendering so it completes right before it.
+ */
+struct sinit_frame_scheduler {
+  sinit_surface *surface;
+  struct sinit_source timer;
+  bool armed;
+  uint32_t pending_time;
+  uint64_t margin;
+  uint64_t render_time;
+
+  // Last presentation.
+  uint64_t refresh;
+  uint64_t presented_time;
+
+  struct sinit_feedback feedbacks[SINIT_FEEDBACK_LEN];
+
+  // Statistics.
+  uint64_t presented;
+  uint64_t dropped;
+  uint64_t missed;
+  uint32_t frame_times[SINIT_STATS_LEN];
+  uint32_t latencies[SINIT_STATS_LEN];
+};
+
+/**
+ * A set of buffers sharing a single growable wl_shm_pool. Buffers are created
+ * lazily and reused across frames, the pool is only grown when surface
+ * doesn't fit anymore.
+ */
+struct sinit_swapchain {
+  sinit_surface *surface;
+  struct wl_shm_pool *pool;
+  int fd;
+  void *data;
+  size_t size;
+  // Pool is backed by explicit huge pages.
+  bool hugetlb;
+
+  // Geometry of buffers.
+  int width;
+  int height;
+  int stride;
+  enum sinit_format format;
+
+  // Bytes reserved per buffer in pool. Slots grow by buckets and never
+  // shrink so that buffer offsets don't change on every resize.
+  size_t slot_size;
+  // Frame since which buffers are at most half as large as slots and whether
+  // memory past them was released.
+  uint64_t small_since;
+  bool trimmed;
+
+  struct sinit_buffer buffers[SINIT_SWAPCHAIN_LEN];
+
+  // Last presented buffer and damage of the last SINIT_SWAPCHAIN_LEN frames
+  // indexed by frame number.
+  struct sinit_buffer *front;
+  uint64_t frame;
+  struct sinit_damage history[SINIT_SWAPCHAIN_LEN];
+};
+
+/**
+ * Tiles of a tiled surface. Tile i covers column i % cols and row i / cols.
+ */
+struct sinit_tiles {
+  sinit_tile_render_fn render;
+  int size;
+  int cols;
+  int rows;
+  // Bitmap of tiles invalidated since last render.
+  uint64_t *dirty;
+  // Tiles rendered by current frame.
+  int *list;
+  int n_list;
+};
+
+/**
+ * A frame of a surface rendered by a worker thread. See
+ * sinit_set_render_threads().
+ */
+struct sinit_render_job {
+  sinit_surface *surface;
+  struct sinit_buffer *buffer;
+  int width;
+  int height;
+  double scale;
+  uint32_t time;
+  // Duration of render function in nanoseconds.
+  uint64_t duration;
+  // Job was submitted and wasn't committed yet.
+  bool in_flight;
+  // Worker completed the job.
+  bool done;
+  // Render function requested a new frame.
+  bool frame_requested;
+};
+
+struct sinit_base_surface {
+  enum sinit_surface_type type;
+  struct wl_surface *wl_surface;
+  struct wl_callback *wl_callback;
+  struct sinit_swapchain swapchain;
+  struct wp_fractional_scale_v1 *fractional_scale;
+  struct wp_viewport *viewport;
+  // Scale in 1/SINIT_SCALE_DENOMINATOR units.
+  uint32_t scale;
+  // Wayland objects of surface were destroyed because a global they depend
+  // on was removed, surface is rebuilt once it is back.
+  bool lost;
+  // Number of outputs surface is displayed on.
+  int n_outputs;
+  // Surface left all outputs or compositor suspended it.
+  bool offscreen;
+  bool suspended;
+
+  // Render only when a frame was requested and content changed since last
+  // render.
+  bool on_demand;
+  bool dirty;
+
+  // Damage of frame being rendered and whether buffer contains previous
+  // frame.
+  struct sinit_damage damage;
+  bool buffer_valid;
+
+  struct sinit_frame_scheduler scheduler;
+  struct sinit_render_job job;
+  struct sinit_tiles tiles;
+
+  // Regions declared by user and last regions sent to the compositor.
+  struct sinit_region opaque_region;
+  struct sinit_region input_region;
+  struct sinit_region sent_opaque_region;
+  struct sinit_region sent_input_region;
+
+  // Config.
+  struct sinit_surface_config config;
+
+  // Acceptable buffer formats in order of preference.
+  enum sinit_format formats[SINIT_FORMAT_COUNT];
+  int n_formats;
+
+  sinit_input_fn input;
+  enum sinit_cursor cursor;
+
+  sinit_render_fn render;
+  uint32_t prev_render;
+  // A render was requested while all buffers were busy.
+  bool render_pending;
+  uint32_t pending_render;
+  void *userdata;
+  bool closed;
+};
+
+/**
+ * A window or XDG shell surface in Wayland terms.
+ */
+struct sinit_xdg_toplevel_surface {
+  struct sinit_base_surface base;
+  struct xdg_toplevel *xdg_toplevel;
+  struct xdg_surface *xdg_surface;
+
+  // Config.
+  struct sinit_surface_config pending_config;
+  bool pending_suspended;
+  // Latest configure event not acked yet.
+  uint32_t configure_serial;
+  bool configure_pending;
+};
 
 /**
  * Layers at which a layer shell surface can be rendered in. They are ordered by
@@ -54,36 +566,269 @@ enum sinit_anchor {
   SINIT_ANCHOR_RIGHT_EXCLUSIVE = 128,
 };
 
+/**
+ * A layer shell surface.
+ */
+struct sinit_layer_surface {
+  struct sinit_base_surface base;
+  struct zwlr_layer_surface_v1 *layer_surface;
+
+  // Parameters layer surface is created with again when rebuilt.
+  struct sinit_output *output;
+  enum sinit_layer layer;
+  enum sinit_anchor anchors;
+  int exclusive;
+  int width;
+  int height;
+  int margin_top;
+  int margin_right;
+  int margin_bottom;
+  int margin_left;
+};
+
+/**
+ * A surface displayed relative to a parent surface and updated independently
+ * of it.
+ */
+struct sinit_subsurface {
+  struct sinit_base_surface base;
+  struct wl_subsurface *subsurface;
+  sinit_surface *parent;
+  int x;
+  int y;
+};
+
+/**
+ * A generic surface type. Fields are private and must not be accessed
+ * directly, use sinit_surface_xxx functions instead.
+ */
+union sinit_surface {
+  struct sinit_base_surface base;
+  struct sinit_xdg_toplevel_surface xdg;
+  struct sinit_layer_surface layer;
+  struct sinit_subsurface sub;
+};
+
 /* Surface initialization public API */
 
 /**
  * Initialize library state and connect to display server. This function panics
- * if it failed to do so.
+ * if it failed to do so. Globals removed by the compositor afterward don't
+ * abort: surfaces depending on them are rebuilt in place once they are
+ * advertised again.
  */
 void sinit_init(const char *app_id);
 
 /**
- * Process all incoming events and returns a non-negative integer on success and
- * -1 on error.
+ * Waits for and process incoming events and returns a non-negative integer on
+ * success and -1 on error.
  */
 int sinit_run();
 
 /**
- * Returns file descriptor to poll on to detect new event.
+ * Returns file descriptor to poll on to detect new event. This is an epoll
+ * file descriptor watching Wayland connection and frame timers.
  */
 int sinit_fd();
 
+/**
+ * Functions to integrate sinit in a foreign event loop. sinit_prepare() must
+ * be called before the loop blocks on sinit_fd() and sinit_dispatch_pending()
+ * once it is readable:
+ *
+ *   sinit_prepare();
+ *   poll(sinit_fd(), ...);
+ *   sinit_dispatch_pending();
+ *
+ * See sinit_sd_event.h and sinit_pw_loop.h for ready-made adapters.
+ */
+
+/**
+ * Dispatches already queued events, prepares reading events from display
+ * and flushes requests. It returns 0 on success and -1 on error. Calling it
+ * multiple times before sinit_dispatch_pending() is allowed.
+ */
+int sinit_prepare();
+
+/**
+ * Reads events available without blocking and dispatches them. It returns a
+ * non-negative integer on success and -1 on error.
+ */
+int sinit_dispatch_pending();
+
+/**
+ * Flushes buffered requests to display. It returns 0 on success and -1 on
+ * error. If socket buffer is full, fd returned by sinit_fd() becomes ready
+ * once display is writable and sinit_dispatch_pending() flushes the rest.
+ */
+int sinit_flush();
+
+/**
+ * Enables or disables explicit huge pages (MFD_HUGETLB) for large buffers.
+ * Huge pages must be reserved by system administrator, regular pages are used
+ * as fallback. Disabled by default.
+ */
+void sinit_set_hugetlb(bool enabled);
+
+/**
+ * Sets number of worker threads rendering surfaces. Render functions of
+ * different surfaces then run in parallel while the thread dispatching events
+ * only attaches and commits rendered buffers. 0, the default, renders surfaces
+ * synchronously while dispatching events. This must be called before any
+ * surface is created.
+ */
+void sinit_set_render_threads(int n);
+
+/**
+ * Sets number of worker threads rendering tiles of tiled surfaces in addition
+ * to the thread rendering the frame. 0, the default, renders tiles
+ * sequentially. This must be called before any surface is created.
+ */
+void sinit_set_tile_threads(int n);
+
+/**
+ * Sets output hotplug listener. added is immediately called for all known
+ * outputs. Passing NULL removes current listener.
+ */
+void sinit_set_output_listener(const struct sinit_output_listener *listener,
+                               void *userdata);
+
 /**
  * Deinitialize library state and free associated resources.
  */
 void sinit_deinit();
 
+/**
+ * Adds rectangle to damage. Rectangles are merged when it is cheaper than
+ * damaging both of them or when there is no room left.
+ */
+void sinit_damage_add(struct sinit_damage *damage, struct sinit_rect rect);
+
+/**
+ * Converts a surface-local length to buffer pixels at the given scale, the
+ * way sinit sizes buffers. Render functions must use it instead of rounding
+ * length * scale themselves, which can be off by one pixel at fractional
+ * scales.
+ */
+int sinit_scale_length(int length, double scale);
+
 /* Surface methods */
 
 bool sinit_surface_closed(sinit_surface *surf);
 
+/**
+ * Requests a new frame. It is safe to call from the render function, even if
+ * it runs on a worker thread. Requests made before the frame is rendered are
+ * coalesced into a single frame. Frames of hidden surfaces (suspended by the
+ * compositor or off all outputs) are delayed until they are shown again.
+ */
 void sinit_surface_request_frame(sinit_surface *surf);
 
+/**
+ * Enables or disables render-on-demand mode. In this mode, sinit only renders
+ * surface after sinit_surface_request_frame() or sinit_surface_invalidate()
+ * and when its size or scale changed, configure events alone don't trigger a
+ * render. Disabled by default.
+ */
+void sinit_surface_on_demand(sinit_surface *surf, bool enabled);
+
+/**
+ * Adds a rectangle, in buffer coordinates, to the damaged area of the frame
+ * being rendered. This must be called from the render function. If render
+ * function doesn't report any damage, the entire surface is considered
+ * damaged.
+ */
+void sinit_surface_damage(sinit_surface *surf, int x, int y, int width,
+                          int height);
+
+/**
+ * Returns whether the buffer being rendered already contains the previous
+ * frame. If it doesn't, the render function must repaint the entire buffer.
+ * This must be called from the render function.
+ */
+bool sinit_surface_buffer_valid(sinit_surface *surf);
+
+/**
+ * Sets the time, in nanoseconds, between the end of a render and the
+ * predicted vblank. Rendering is delayed as much as this margin allows to
+ * reduce latency. A margin greater than refresh interval disables delaying.
+ */
+void sinit_surface_frame_margin(sinit_surface *surf, uint64_t margin);
+
+/**
+ * Retrieves frame statistics of surface.
+ */
+void sinit_surface_frame_stats(sinit_surface *surf,
+                               struct sinit_frame_stats *stats);
+
+/**
+ * Sets buffer formats render function supports in order of preference. The
+ * first one supported by the compositor is used, ARGB8888 if there is none.
+ * Defaults to XRGB8888 then ARGB8888 for opaque surfaces and ARGB8888
+ * otherwise. Formats without alpha channel must only be used by opaque
+ * surfaces. An empty list (n_formats <= 0) restores the defaults.
+ */
+void sinit_surface_formats(sinit_surface *surf,
+                           const enum sinit_format *formats, int n_formats);
+
+/**
+ * Returns name of the given format.
+ */
+const char *sinit_format_name(enum sinit_format format);
+
+/**
+ * Sets opaque region of surface, a list of rectangles in surface-local
+ * coordinates. Compositor can skip blending what lies under it. Passing NULL
+ * marks the entire surface opaque whatever its size. Rectangles beyond
+ * SINIT_REGION_MAX_RECTS are ignored. Region is sent on next commit if it
+ * changed.
+ */
+void sinit_surface_opaque_region(sinit_surface *surf,
+                                 const struct sinit_rect *rects, int n_rects);
+
+/**
+ * Sets input region of surface, a list of rectangles in surface-local
+ * coordinates. Input events outside of it go to surfaces below. Passing NULL
+ * makes the entire surface accept input, the default. Rectangles beyond
+ * SINIT_REGION_MAX_RECTS are merged with the last one. Region is sent on next
+ * commit if it changed.
+ */
+void sinit_surface_input_region(sinit_surface *surf,
+                                const struct sinit_rect *rects, int n_rects);
+
+/**
+ * Switches surface to tiled rendering. Buffer is split in tile_size pixels
+ * large square tiles (SINIT_DEFAULT_TILE_SIZE if 0) and render is called for
+ * each tile invalidated since the previous frame, tiles are distributed
+ * across tile threads. Surface damage is derived from rendered tiles,
+ * sinit_surface_damage() must not be used. Frames without dirty tiles are
+ * skipped.
+ */
+void sinit_surface_tiled(sinit_surface *surf, sinit_tile_render_fn render,
+                         int tile_size);
+
+/**
+ * Marks tiles intersecting given rectangle, in buffer coordinates, dirty. They
+ * will be rendered on next frame, which is requested in render-on-demand mode.
+ * This must not be called from the render function.
+ */
+void sinit_surface_invalidate(sinit_surface *surf, int x, int y, int width,
+                              int height);
+
+/**
+ * Sets input function of surface, NULL, the default, ignores input events.
+ * userdata of surface is passed to it. This must be called after surface is
+ * initialized.
+ */
+void sinit_surface_input(sinit_surface *surf, sinit_input_fn input);
+
+/**
+ * Sets cursor displayed while pointer is over surface. Cursors are set using
+ * the cursor shape protocol, compositor picks the cursor if it doesn't
+ * support it.
+ */
+void sinit_surface_cursor(sinit_surface *surf, enum sinit_cursor cursor);
+
 /* XDG Shell surface methods */
 
 /**
@@ -101,11 +846,13 @@ void sinit_xdg_toplevel_surface_deinit(sinit_surface *surf);
 /* Layer shell surface */
 
 /**
- * Initializes a layer shell surface (e.g. not a window).
+ * Initializes a layer shell surface (e.g. not a window) on the given output.
+ * If output is NULL, compositor chooses one. Use sinit_set_output_listener()
+ * to create a surface per output.
  */
-void sinit_layer_surface_init(sinit_surface *surf, enum sinit_layer layer,
-                              enum sinit_anchor anchors, int exclusive,
-                              int width, int height, bool opaque,
+void sinit_layer_surface_init(sinit_surface *surf, struct sinit_output *output,
+                              enum sinit_layer layer, enum sinit_anchor anchors,
+                              int exclusive, int width, int height, bool opaque,
                               sinit_render_fn render, void *userdata);
 
 /**
@@ -121,4 +868,33 @@ void sinit_layer_surface_margin(sinit_surface *surf, int top, int right,
  */
 void sinit_layer_surface_deinit(sinit_surface *surf);
 
+/* Subsurface */
+
+/**
+ * Initializes a width x height subsurface of parent at position x, y in
+ * parent surface-local coordinates. Subsurfaces have their own swapchain and
+ * are committed in desynchronized mode: a frequently updated part of a
+ * surface (e.g. a clock) can be rendered at its own rate while parent, in
+ * render-on-demand mode, is only rendered when its own content changes.
+ * Subsurface is displayed once parent is.
+ */
+void sinit_subsurface_init(sinit_surface *surf, sinit_surface *parent, int x,
+                           int y, int width, int height, bool opaque,
+                           sinit_render_fn render, void *userdata);
+
+/**
+ * Moves subsurface to x, y in parent surface-local coordinates.
+ */
+void sinit_subsurface_position(sinit_surface *surf, int x, int y);
+
+/**
+ * Resizes subsurface, a new frame is rendered if size changed.
+ */
+void sinit_subsurface_resize(sinit_surface *surf, int width, int height);
+
+/**
+ * Deinitializes a subsurface. It must be deinitialized before its parent.
+ */
+void sinit_subsurface_deinit(sinit_surface *surf);
+
 #endif
@@ -0,0 +1,449 @@
+#include <string.h>
+
+#include "sinit_draw.h"
+
+#include "macros.h"
+
+#ifndef LOG_MODULE
+#define LOG_MODULE "sinit_draw"
+#endif
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SINIT_DRAW_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SINIT_DRAW_NEON 1
+#endif
+
+/**
+ * Pixel kernels implementation. All implementations produce the exact same
+ * output, x / 255 is computed as (t + (t >> 8)) >> 8 with t = x + 128.
+ */
+struct kernels {
+  const char *name;
+  void (*fill)(uint32_t *dst, size_t n, uint32_t color);
+  void (*blend)(uint32_t *dst, const uint32_t *src, size_t n);
+  void (*mask)(uint32_t *dst, const uint8_t *mask, size_t n, uint32_t color);
+};
+
+/* Scalar */
+
+static inline uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+// Multiplies each channel of px by m / 255.
+static inline uint32_t px_mul(uint32_t px, uint32_t m) {
+  uint32_t r = 0;
+  for (int shift = 0; shift < 32; shift += 8)
+    r |= div255(((px >> shift) & 0xff) * m) << shift;
+  return r;
+}
+
+// Composites src over dst, channels saturate at 255.
+static inline uint32_t px_over(uint32_t dst, uint32_t src) {
+  uint32_t d = px_mul(dst, 255 - (src >> 24));
+  uint32_t r = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    uint32_t c = ((src >> shift) & 0xff) + ((d >> shift) & 0xff);
+    r |= (c > 255 ? 255 : c) << shift;
+  }
+  return r;
+}
+
+static void scalar_fill(uint32_t *dst, size_t n, uint32_t color) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = color;
+}
+
+static void scalar_blend(uint32_t *dst, const uint32_t *src, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = px_over(dst[i], src[i]);
+}
+
+static void scalar_mask(uint32_t *dst, const uint8_t *mask, size_t n,
+                        uint32_t color) {
+  for (size_t i = 0; i < n; i++) {
+    if (mask[i] == 0)
+      continue;
+    dst[i] = px_over(dst[i], px_mul(color, mask[i]));
+  }
+}
+
+static const struct kernels scalar_kernels = {
+    .name = "scalar",
+    .fill = scalar_fill,
+    .blend = scalar_blend,
+    .mask = scalar_mask,
+};
+
+#ifdef SINIT_DRAW_X86
+
+/* SSE2 */
+
+__attribute__((target("sse2"))) static inline __m128i
+sse2_div255(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Multiplies 8 bit channels of px by 8 bit channels of m divided by 255.
+__attribute__((target("sse2"))) static inline __m128i sse2_mul(__m128i px,
+                                                               __m128i m) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(px, zero),
+                               _mm_unpacklo_epi8(m, zero));
+  __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(px, zero),
+                               _mm_unpackhi_epi8(m, zero));
+  return _mm_packus_epi16(sse2_div255(lo), sse2_div255(hi));
+}
+
+// Composites 4 src pixels over 4 dst pixels.
+__attribute__((target("sse2"))) static inline __m128i sse2_over(__m128i d,
+                                                                __m128i s) {
+  // 255 - alpha replicated to all channels.
+  __m128i a = _mm_srli_epi32(s, 24);
+  a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+  a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+  a = _mm_xor_si128(a, _mm_set1_epi8((char)0xff));
+  return _mm_adds_epu8(s, sse2_mul(d, a));
+}
+
+__attribute__((target("sse2"))) static void sse2_fill(uint32_t *dst, size_t n,
+                                                      uint32_t color) {
+  __m128i c = _mm_set1_epi32(color);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_si128((__m128i *)(dst + i), c);
+  scalar_fill(dst + i, n - i, color);
+}
+
+__attribute__((target("sse2"))) static void
+sse2_blend(uint32_t *dst, const uint32_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), sse2_over(d, s));
+  }
+  scalar_blend(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2"))) static void
+sse2_mask(uint32_t *dst, const uint8_t *mask, size_t n, uint32_t color) {
+  __m128i c = _mm_set1_epi32(color);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32_t m4;
+    memcpy(&m4, mask + i, sizeof(m4));
+    if (m4 == 0)
+      continue;
+
+    // Replicate mask bytes to all channels of their pixel.
+    __m128i m = _mm_cvtsi32_si128(m4);
+    m = _mm_unpacklo_epi8(m, m);
+    m = _mm_unpacklo_epi16(m, m);
+
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), sse2_over(d, sse2_mul(c, m)));
+  }
+  scalar_mask(dst + i, mask + i, n - i, color);
+}
+
+static const struct kernels sse2_kernels = {
+    .name = "sse2",
+    .fill = sse2_fill,
+    .blend = sse2_blend,
+    .mask = sse2_mask,
+};
+
+/* AVX2 */
+
+__attribute__((target("avx2"))) static inline __m256i
+avx2_div255(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2"))) static inline __m256i avx2_mul(__m256i px,
+                                                               __m256i m) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(px, zero),
+                                  _mm256_unpacklo_epi8(m, zero));
+  __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(px, zero),
+                                  _mm256_unpackhi_epi8(m, zero));
+  return _mm256_packus_epi16(avx2_div255(lo), avx2_div255(hi));
+}
+
+__attribute__((target("avx2"))) static inline __m256i avx2_over(__m256i d,
+                                                                __m256i s) {
+  const __m256i alpha = _mm256_setr_epi8(
+      3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15, 3, 3, 3, 3, 7, 7,
+      7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+  __m256i a = _mm256_shuffle_epi8(s, alpha);
+  a = _mm256_xor_si256(a, _mm256_set1_epi8((char)0xff));
+  return _mm256_adds_epu8(s, avx2_mul(d, a));
+}
+
+__attribute__((target("avx2"))) static void avx2_fill(uint32_t *dst, size_t n,
+                                                      uint32_t color) {
+  __m256i c = _mm256_set1_epi32(color);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i *)(dst + i), c);
+  sse2_fill(dst + i, n - i, color);
+}
+
+__attribute__((target("avx2"))) static void
+avx2_blend(uint32_t *dst, const uint32_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), avx2_over(d, s));
+  }
+  sse2_blend(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+avx2_mask(uint32_t *dst, const uint8_t *mask, size_t n, uint32_t color) {
+  __m256i c = _mm256_set1_epi32(color);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i m8 = _mm_loadl_epi64((const __m128i *)(mask + i));
+    if (_mm_testz_si128(m8, m8))
+      continue;
+
+    // Replicate mask bytes to all channels of their pixel.
+    __m256i m = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(m8),
+                                   _mm256_set1_epi32(0x01010101));
+
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), avx2_over(d, avx2_mul(c, m)));
+  }
+  sse2_mask(dst + i, mask + i, n - i, color);
+}
+
+static const struct kernels avx2_kernels = {
+    .name = "avx2",
+    .fill = avx2_fill,
+    .blend = avx2_blend,
+    .mask = avx2_mask,
+};
+
+#endif
+
+#ifdef SINIT_DRAW_NEON
+
+/* NEON */
+
+// Multiplies 8 bit channels of px by 8 bit channels of m divided by 255.
+static inline uint8x16_t neon_mul(uint8x16_t px, uint8x16_t m) {
+  uint16x8_t lo = vmull_u8(vget_low_u8(px), vget_low_u8(m));
+  uint16x8_t hi = vmull_u8(vget_high_u8(px), vget_high_u8(m));
+  // (x + ((x + 128) >> 8) + 128) >> 8
+  return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+                     vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+static inline uint8x16_t neon_over(uint8x16_t d, uint8x16_t s) {
+  static const uint8_t alpha[16] = {3,  3,  3,  3,  7,  7,  7,  7,
+                                    11, 11, 11, 11, 15, 15, 15, 15};
+  uint8x16_t a = vmvnq_u8(vqtbl1q_u8(s, vld1q_u8(alpha)));
+  return vqaddq_u8(s, neon_mul(d, a));
+}
+
+static void neon_fill(uint32_t *dst, size_t n, uint32_t color) {
+  uint32x4_t c = vdupq_n_u32(color);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    vst1q_u32(dst + i, c);
+  scalar_fill(dst + i, n - i, color);
+}
+
+static void neon_blend(uint32_t *dst, const uint32_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint8x16_t s = vld1q_u8((const uint8_t *)(src + i));
+    uint8x16_t d = vld1q_u8((const uint8_t *)(dst + i));
+    vst1q_u8((uint8_t *)(dst + i), neon_over(d, s));
+  }
+  scalar_blend(dst + i, src + i, n - i);
+}
+
+static void neon_mask(uint32_t *dst, const uint8_t *mask, size_t n,
+                      uint32_t color) {
+  static const uint8_t spread[16] = {0, 0, 0, 0, 1, 1, 1, 1,
+                                     2, 2, 2, 2, 3, 3, 3, 3};
+  uint8x16_t c = vreinterpretq_u8_u32(vdupq_n_u32(color));
+  uint8x16_t idx = vld1q_u8(spread);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32_t m4;
+    memcpy(&m4, mask + i, sizeof(m4));
+    if (m4 == 0)
+      continue;
+
+    // Replicate mask bytes to all channels of their pixel.
+    uint8x16_t m = vqtbl1q_u8(vreinterpretq_u8_u32(vdupq_n_u32(m4)), idx);
+
+    uint8x16_t d = vld1q_u8((const uint8_t *)(dst + i));
+    vst1q_u8((uint8_t *)(dst + i), neon_over(d, neon_mul(c, m)));
+  }
+  scalar_mask(dst + i, mask + i, n - i, color);
+}
+
+static const struct kernels neon_kernels = {
+    .name = "neon",
+    .fill = neon_fill,
+    .blend = neon_blend,
+    .mask = neon_mask,
+};
+
+#endif
+
+static struct kernels kernels = scalar_kernels;
+
+static void CONSTRUCTOR sinit_draw_init(void) {
+#ifdef SINIT_DRAW_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    kernels = avx2_kernels;
+  else if (__builtin_cpu_supports("sse2"))
+    kernels = sse2_kernels;
+#elif defined(SINIT_DRAW_NEON)
+  // NEON is mandatory on aarch64.
+  kernels = neon_kernels;
+#endif
+}
+
+void sinit_draw_fill(uint32_t *dst, size_t n, uint32_t color) {
+  kernels.fill(dst, n, color);
+}
+
+void sinit_draw_rect(void *buf, int stride, int x, int y, int width,
+                     int height, uint32_t color) {
+  char *row = (char *)buf + (size_t)y * stride + (size_t)x * 4;
+  for (int i = 0; i < height; i++, row += stride)
+    kernels.fill((uint32_t *)row, width, color);
+}
+
+void sinit_draw_blend(uint32_t *dst, const uint32_t *src, size_t n) {
+  kernels.blend(dst, src, n);
+}
+
+void sinit_draw_mask(uint32_t *dst, const uint8_t *mask, size_t n,
+                     uint32_t color) {
+  kernels.mask(dst, mask, n, color);
+}
+
+// libc memcpy already dispatches on CPU features and outperforms anything we
+// could write here.
+void sinit_draw_copy(uint32_t *dst, const uint32_t *src, size_t n) {
+  memcpy(dst, src, n * sizeof(*dst));
+}
+
+const char *sinit_draw_backend(void) { return kernels.name; }
+
+// Returns a pseudo random number, xorshift32 keeps runs reproducible.
+static uint32_t unittest_rand(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Returns a random premultiplied pixel, opaque or transparent one time out of
+// four each.
+static uint32_t unittest_rand_px(uint32_t *state) {
+  uint32_t r = unittest_rand(state);
+  uint32_t a = r >> 24;
+  switch (r & 3) {
+  case 0:
+    a = 0;
+    break;
+  case 1:
+    a = 255;
+    break;
+  }
+
+  uint32_t px = a << 24;
+  for (int shift = 0; shift < 24; shift += 8)
+    px |= (unittest_rand(state) % (a + 1)) << shift;
+  return px;
+}
+
+// Checks that every compiled backend matches scalar kernels.
+UNITTEST {
+  const struct kernels *backends[4];
+  size_t n_backends = 0;
+#ifdef SINIT_DRAW_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    backends[n_backends++] = &sse2_kernels;
+  if (__builtin_cpu_supports("avx2"))
+    backends[n_backends++] = &avx2_kernels;
+#elif defined(SINIT_DRAW_NEON)
+  backends[n_backends++] = &neon_kernels;
+#endif
+
+  // Lengths around multiples of 4 and 8 pixels so vector loops run with and
+  // without a scalar tail.
+  static const size_t lens[] = {0,  1,  2,  3,  4,  5,  7,  8,  9,
+                                11, 12, 15, 16, 17, 23, 31, 32, 33,
+                                63, 64, 65, 67, 100};
+  enum { MAX_LEN = 100 };
+  uint32_t src[MAX_LEN], dst[MAX_LEN], want[MAX_LEN], got[MAX_LEN];
+  uint8_t mask[MAX_LEN];
+  uint32_t state = 0x9e3779b9;
+
+  for (size_t b = 0; b < n_backends; b++) {
+    const struct kernels *k = backends[b];
+    for (size_t l = 0; l < ALEN(lens); l++) {
+      size_t n = lens[l];
+      for (int round = 0; round < 16; round++) {
+        uint32_t color = unittest_rand_px(&state);
+        for (size_t i = 0; i < n; i++) {
+          src[i] = unittest_rand_px(&state);
+          dst[i] = unittest_rand_px(&state);
+        }
+        // Zero runs of 4 so mask kernels skip empty blocks, 255 so they hit
+        // the opaque case.
+        for (size_t i = 0; i < n; i++) {
+          uint32_t r = unittest_rand(&state);
+          if ((i / 4 + round) % 3 == 0)
+            mask[i] = 0;
+          else if ((r & 7) == 0)
+            mask[i] = 255;
+          else
+            mask[i] = r >> 24;
+        }
+
+        memcpy(want, dst, n * sizeof(*dst));
+        memcpy(got, dst, n * sizeof(*dst));
+        scalar_kernels.fill(want, n, color);
+        k->fill(got, n, color);
+        if (memcmp(want, got, n * sizeof(*got)) != 0)
+          BUG("%s fill differs from scalar, n=%zu", k->name, n);
+
+        memcpy(want, dst, n * sizeof(*dst));
+        memcpy(got, dst, n * sizeof(*dst));
+        scalar_kernels.blend(want, src, n);
+        k->blend(got, src, n);
+        if (memcmp(want, got, n * sizeof(*got)) != 0)
+          BUG("%s blend differs from scalar, n=%zu", k->name, n);
+
+        memcpy(want, dst, n * sizeof(*dst));
+        memcpy(got, dst, n * sizeof(*dst));
+        scalar_kernels.mask(want, mask, n, color);
+        k->mask(got, mask, n, color);
+        if (memcmp(want, got, n * sizeof(*got)) != 0)
+          BUG("%s mask differs from scalar, n=%zu", k->name, n);
+      }
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef SINIT_DRAW_H_INCLUDE
+#define SINIT_DRAW_H_INCLUDE
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Pixel kernels operating on premultiplied ARGB8888 (or XRGB8888) buffers such
+ * as the one passed to sinit_render_fn. SSE2, AVX2 or NEON implementation is
+ * selected at startup depending on CPU features, a scalar implementation is
+ * used otherwise.
+ *
+ * Strides are in bytes, lengths are in pixels.
+ */
+
+/**
+ * Returns a premultiplied ARGB8888 color from straight alpha components.
+ */
+static inline uint32_t sinit_draw_color(uint8_t a, uint8_t r, uint8_t g,
+                                        uint8_t b) {
+  r = (r * a + 127) / 255;
+  g = (g * a + 127) / 255;
+  b = (b * a + 127) / 255;
+  return (uint32_t)a << 24 | (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+}
+
+/**
+ * Fills n pixels of dst with color.
+ */
+void sinit_draw_fill(uint32_t *dst, size_t n, uint32_t color);
+
+/**
+ * Fills a rectangle of buf with color. Rectangle must lie within buffer.
+ */
+void sinit_draw_rect(void *buf, int stride, int x, int y, int width,
+                     int height, uint32_t color);
+
+/**
+ * Composites n pixels of src over dst.
+ */
+void sinit_draw_blend(uint32_t *dst, const uint32_t *src, size_t n);
+
+/**
+ * Composites color through n pixels of an A8 mask (e.g. a glyph) over dst.
+ */
+void sinit_draw_mask(uint32_t *dst, const uint8_t *mask, size_t n,
+                     uint32_t color);
+
+/**
+ * Copies n pixels of src to dst. Pixels must not overlap.
+ */
+void sinit_draw_copy(uint32_t *dst, const uint32_t *src, size_t n);
+
+/**
+ * Returns name of selected kernel implementation: "avx2", "sse2", "neon" or
+ * "scalar".
+ */
+const char *sinit_draw_backend(void);
+
+#endif
@@ -0,0 +1,62 @@
+// Single header file integrating sinit in a PipeWire loop.
+
+#ifndef SINIT_PW_LOOP_H_INCLUDE
+#define SINIT_PW_LOOP_H_INCLUDE
+
+#include <errno.h>
+
+#include <pipewire/loop.h>
+#include <spa/support/loop.h>
+
+#include "sinit.h"
+
+struct sinit_pw_loop {
+  struct pw_loop *loop;
+  struct spa_source *source;
+  struct spa_hook hook;
+};
+
+static void sinit_pw_loop_before(void *data) {
+  (void)data;
+  sinit_prepare();
+}
+
+static void sinit_pw_loop_io(void *data, int fd, uint32_t mask) {
+  (void)data;
+  (void)fd;
+  (void)mask;
+  sinit_dispatch_pending();
+}
+
+static const struct spa_loop_control_hooks sinit_pw_loop_hooks = {
+    SPA_VERSION_LOOP_CONTROL_HOOKS,
+    .before = sinit_pw_loop_before,
+};
+
+/**
+ * Attaches sinit to the given PipeWire loop. sinit must be initialized. Events
+ * are read and dispatched from within the loop, sinit_run() must not be
+ * called. It returns a negative errno on error.
+ */
+static inline int sinit_attach_pw_loop(struct sinit_pw_loop *l,
+                                       struct pw_loop *loop) {
+  l->loop = loop;
+  l->source =
+      pw_loop_add_io(loop, sinit_fd(), SPA_IO_IN, false, sinit_pw_loop_io, l);
+  if (l->source == NULL)
+    return -errno;
+
+  pw_loop_add_hook(loop, &l->hook, &sinit_pw_loop_hooks, l);
+  return 0;
+}
+
+/**
+ * Detaches sinit from PipeWire loop it was attached to.
+ */
+static inline void sinit_detach_pw_loop(struct sinit_pw_loop *l) {
+  spa_hook_remove(&l->hook);
+  pw_loop_destroy_source(l->loop, l->source);
+  l->source = NULL;
+}
+
+#endif
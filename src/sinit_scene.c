@@ -0,0 +1,726 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sinit_draw.h"
+#include "sinit_scene.h"
+
+#ifndef LOG_MODULE
+#define LOG_MODULE "sinit_scene"
+#endif
+#include "log.h"
+
+enum node_type {
+  NODE_GROUP,
+  NODE_RECT,
+  NODE_TEXT,
+  NODE_ICON,
+};
+
+struct sinit_node {
+  enum node_type type;
+  struct sinit_scene *scene;
+  struct sinit_node *parent;
+  struct sinit_node *first_child;
+  struct sinit_node *last_child;
+  struct sinit_node *prev;
+  struct sinit_node *next;
+
+  // Requested geometry, a 0 size is replaced by intrinsic size.
+  int x;
+  int y;
+  int width;
+  int height;
+  bool visible;
+  uint32_t color;
+
+  // Group.
+  enum sinit_layout layout;
+  bool clip;
+  int spacing;
+  int padding;
+
+  // Text.
+  struct sinit_font *font;
+  char *text;
+  // Ascent in buffer pixels at scale of last measure.
+  int ascent;
+
+  // Icon.
+  uint32_t *pixels;
+  int icon_width;
+  int icon_height;
+
+  // Intrinsic size computed by last measure and bounds computed by last
+  // layout.
+  int measured_width;
+  int measured_height;
+  struct sinit_rect bounds;
+  // Area painted by last render in buffer coordinates.
+  struct sinit_rect painted;
+
+  // Intrinsic size of node may have changed.
+  bool measure_dirty;
+  // Children of node must be placed again.
+  bool layout_dirty;
+  // Node must be repainted.
+  bool paint_dirty;
+  // Node or one of its descendants must be repainted.
+  bool subtree_dirty;
+};
+
+static int round_px(double v) { return v < 0 ? v - 0.5 : v + 0.5; }
+
+static int ceil_px(double v) {
+  int i = v;
+  return i < v ? i + 1 : i;
+}
+
+static bool rect_empty(struct sinit_rect r) {
+  return r.width <= 0 || r.height <= 0;
+}
+
+static struct sinit_rect rect_intersect(struct sinit_rect a,
+                                        struct sinit_rect b) {
+  int x0 = a.x > b.x ? a.x : b.x;
+  int y0 = a.y > b.y ? a.y : b.y;
+  int x1 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+  int y1 = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+  if (x1 <= x0 || y1 <= y0)
+    return (struct sinit_rect){0};
+  return (struct sinit_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+static bool rect_equal(struct sinit_rect a, struct sinit_rect b) {
+  return a.x == b.x && a.y == b.y && a.width == b.width &&
+         a.height == b.height;
+}
+
+// Converts a surface-local rectangle to buffer coordinates.
+static struct sinit_rect rect_scale(struct sinit_rect r, double scale) {
+  int x0 = round_px(r.x * scale);
+  int y0 = round_px(r.y * scale);
+  int x1 = round_px((r.x + r.width) * scale);
+  int y1 = round_px((r.y + r.height) * scale);
+  return (struct sinit_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+// Requests a frame to render changes of scene.
+static void scene_changed(struct sinit_scene *scene) {
+  sinit_surface_request_frame(scene->surface);
+}
+
+static void node_mark_paint(struct sinit_node *node) {
+  node->paint_dirty = true;
+  for (struct sinit_node *n = node; n != NULL; n = n->parent)
+    n->subtree_dirty = true;
+}
+
+// Marks node and its ancestors for measure and layout.
+static void node_mark_layout(struct sinit_node *node) {
+  for (struct sinit_node *n = node; n != NULL; n = n->parent) {
+    n->measure_dirty = true;
+    n->layout_dirty = true;
+  }
+}
+
+// Marks node and its descendants for measure, layout and repaint.
+static void node_mark_subtree(struct sinit_node *node) {
+  node_mark_layout(node);
+  node_mark_paint(node);
+  for (struct sinit_node *c = node->first_child; c != NULL; c = c->next)
+    node_mark_subtree(c);
+}
+
+// Damages area painted by node and its descendants and forgets it.
+static void node_unpaint(struct sinit_node *node) {
+  sinit_damage_add(&node->scene->damage, node->painted);
+  node->painted = (struct sinit_rect){0};
+  for (struct sinit_node *c = node->first_child; c != NULL; c = c->next)
+    node_unpaint(c);
+}
+
+static struct sinit_node *node_new(struct sinit_scene *scene,
+                                   struct sinit_node *parent,
+                                   enum node_type type) {
+  struct sinit_node *node = calloc(1, sizeof(*node));
+  if (node == NULL)
+    LOG_FATAL("failed to allocate scene node");
+
+  node->type = type;
+  node->scene = scene;
+  node->visible = true;
+
+  if (parent != NULL) {
+    node->parent = parent;
+    node->prev = parent->last_child;
+    if (parent->last_child != NULL)
+      parent->last_child->next = node;
+    else
+      parent->first_child = node;
+    parent->last_child = node;
+  }
+
+  node_mark_layout(node);
+  node_mark_paint(node);
+  return node;
+}
+
+static void node_free(struct sinit_node *node) {
+  struct sinit_node *c = node->first_child;
+  while (c != NULL) {
+    struct sinit_node *next = c->next;
+    node_free(c);
+    c = next;
+  }
+
+  free(node->text);
+  free(node->pixels);
+  free(node);
+}
+
+static void node_size(struct sinit_node *node, double scale, int *width,
+                      int *height);
+
+// Computes intrinsic size of node.
+static void node_measure(struct sinit_node *node, double scale) {
+  int w = 0;
+  int h = 0;
+
+  switch (node->type) {
+  case NODE_GROUP: {
+    int n = 0;
+    for (struct sinit_node *c = node->first_child; c != NULL; c = c->next) {
+      if (!c->visible)
+        continue;
+
+      int cw, ch;
+      node_size(c, scale, &cw, &ch);
+      switch (node->layout) {
+      case SINIT_LAYOUT_NONE:
+        w = c->x + cw > w ? c->x + cw : w;
+        h = c->y + ch > h ? c->y + ch : h;
+        break;
+      case SINIT_LAYOUT_ROW:
+        w += cw;
+        h = ch > h ? ch : h;
+        break;
+      case SINIT_LAYOUT_COLUMN:
+        w = cw > w ? cw : w;
+        h += ch;
+        break;
+      }
+      n++;
+    }
+
+    if (node->layout == SINIT_LAYOUT_ROW && n > 0)
+      w += (n - 1) * node->spacing;
+    else if (node->layout == SINIT_LAYOUT_COLUMN && n > 0)
+      h += (n - 1) * node->spacing;
+    if (node->layout != SINIT_LAYOUT_NONE) {
+      w += 2 * node->padding;
+      h += 2 * node->padding;
+    }
+    break;
+  }
+
+  case NODE_RECT:
+    break;
+
+  case NODE_TEXT: {
+    if (node->font == NULL)
+      break;
+
+    struct sinit_text_extents e;
+    sinit_text_extents(node->font, scale, node->text, &e);
+    w = ceil_px(e.width / scale);
+    h = ceil_px((e.ascent + e.descent) / scale);
+    node->ascent = e.ascent;
+    break;
+  }
+
+  case NODE_ICON:
+    w = ceil_px(node->icon_width / scale);
+    h = ceil_px(node->icon_height / scale);
+    break;
+  }
+
+  node->measured_width = w;
+  node->measured_height = h;
+  node->measure_dirty = false;
+}
+
+// Returns size of node, measuring it if needed.
+static void node_size(struct sinit_node *node, double scale, int *width,
+                      int *height) {
+  if (node->measure_dirty)
+    node_measure(node, scale);
+
+  *width = node->width > 0 ? node->width : node->measured_width;
+  *height = node->height > 0 ? node->height : node->measured_height;
+}
+
+// Places node at x, y then its children. Subtrees that are neither dirty nor
+// moved are skipped.
+static void node_layout(struct sinit_node *node, int x, int y, double scale) {
+  struct sinit_rect bounds = {x, y, 0, 0};
+  node_size(node, scale, &bounds.width, &bounds.height);
+
+  bool moved = !rect_equal(bounds, node->bounds);
+  if (!node->layout_dirty && !moved)
+    return;
+
+  if (moved) {
+    node->bounds = bounds;
+    node_mark_paint(node);
+  }
+  node->layout_dirty = false;
+
+  int cx = x + node->padding;
+  int cy = y + node->padding;
+  for (struct sinit_node *c = node->first_child; c != NULL; c = c->next) {
+    if (!c->visible)
+      continue;
+
+    int cw, ch;
+    node_size(c, scale, &cw, &ch);
+    switch (node->layout) {
+    case SINIT_LAYOUT_NONE:
+      node_layout(c, x + c->x, y + c->y, scale);
+      break;
+    case SINIT_LAYOUT_ROW:
+      node_layout(c, cx, cy, scale);
+      cx += cw + node->spacing;
+      break;
+    case SINIT_LAYOUT_COLUMN:
+      node_layout(c, cx, cy, scale);
+      cy += ch + node->spacing;
+      break;
+    }
+  }
+}
+
+// Damages previous and new area of nodes to repaint.
+static void node_collect(struct sinit_node *node, bool visible, double scale,
+                         struct sinit_damage *damage) {
+  if (!node->subtree_dirty)
+    return;
+  node->subtree_dirty = false;
+
+  visible = visible && node->visible;
+  if (node->paint_dirty) {
+    node->paint_dirty = false;
+    sinit_damage_add(damage, node->painted);
+    node->painted = visible ? rect_scale(node->bounds, scale)
+                            : (struct sinit_rect){0};
+    sinit_damage_add(damage, node->painted);
+  }
+
+  for (struct sinit_node *c = node->first_child; c != NULL; c = c->next)
+    node_collect(c, visible, scale, damage);
+}
+
+// Composites color over rectangle r of buffer.
+static void fill(void *buf, int stride, struct sinit_rect r, uint32_t color) {
+  if (color == 0 || rect_empty(r))
+    return;
+
+  if (color >> 24 == 0xff) {
+    sinit_draw_rect(buf, stride, r.x, r.y, r.width, r.height, color);
+    return;
+  }
+
+  // Composite color through an opaque mask, chunk by chunk.
+  uint8_t mask[256];
+  int chunk = sizeof(mask);
+  memset(mask, 0xff, sizeof(mask));
+  for (int y = r.y; y < r.y + r.height; y++) {
+    uint32_t *row = (uint32_t *)((char *)buf + (size_t)y * stride);
+    for (int x = r.x; x < r.x + r.width; x += chunk) {
+      int n = r.x + r.width - x;
+      sinit_draw_mask(row + x, mask, n < chunk ? n : chunk, color);
+    }
+  }
+}
+
+// Paints node and its children within clip rectangle.
+static void node_paint(struct sinit_node *node, void *buf, int stride,
+                       struct sinit_rect clip, double scale) {
+  if (!node->visible)
+    return;
+
+  struct sinit_rect r = rect_intersect(node->painted, clip);
+
+  switch (node->type) {
+  case NODE_GROUP:
+    fill(buf, stride, r, node->color);
+    if (node->clip) {
+      if (rect_empty(r))
+        return;
+      clip = r;
+    }
+    for (struct sinit_node *c = node->first_child; c != NULL; c = c->next)
+      node_paint(c, buf, stride, clip, scale);
+    break;
+
+  case NODE_RECT:
+    fill(buf, stride, r, node->color);
+    break;
+
+  case NODE_TEXT:
+    if (rect_empty(r) || node->font == NULL)
+      break;
+
+    // Draw on a sub-buffer to clip text.
+    sinit_text_draw((char *)buf + (size_t)r.y * stride + (size_t)r.x * 4,
+                    stride, r.width, r.height, node->font, scale,
+                    node->painted.x - r.x, node->painted.y + node->ascent - r.y,
+                    node->text, node->color);
+    break;
+
+  case NODE_ICON: {
+    struct sinit_rect icon = {node->painted.x, node->painted.y,
+                              node->icon_width, node->icon_height};
+    r = rect_intersect(r, icon);
+    for (int y = r.y; y < r.y + r.height; y++) {
+      sinit_draw_blend((uint32_t *)((char *)buf + (size_t)y * stride) + r.x,
+                       node->pixels + (size_t)(y - icon.y) * icon.width +
+                           (r.x - icon.x),
+                       r.width);
+    }
+    break;
+  }
+  }
+}
+
+/**
+ * Initializes an empty scene rendered on surf, whose render function must be
+ * sinit_scene_render() with scene as userdata. Surface doesn't need to be
+ * initialized yet but must be before nodes are created. Areas not covered by
+ * any node are filled with background.
+ */
+void sinit_scene_init(struct sinit_scene *scene, sinit_surface *surf,
+                      uint32_t background) {
+  *scene = (struct sinit_scene){0};
+  scene->surface = surf;
+  scene->background = background;
+  pthread_mutex_init(&scene->lock, NULL);
+  scene->root = node_new(scene, NULL, NODE_GROUP);
+}
+
+/**
+ * Destroys all nodes of scene.
+ */
+void sinit_scene_deinit(struct sinit_scene *scene) {
+  node_free(scene->root);
+  scene->root = NULL;
+  pthread_mutex_destroy(&scene->lock);
+}
+
+/**
+ * Returns root group of scene. It has the size of the surface and places its
+ * children with SINIT_LAYOUT_NONE by default.
+ */
+struct sinit_node *sinit_scene_root(struct sinit_scene *scene) {
+  return scene->root;
+}
+
+/**
+ * Render function of surfaces displaying a scene, userdata is the scene.
+ */
+void sinit_scene_render(sinit_surface *surf, void *buf, int width, int height,
+                        int stride, enum sinit_format format, double scale,
+                        uint32_t time, void *userdata) {
+  (void)format;
+  (void)time;
+
+  struct sinit_scene *scene = userdata;
+  struct sinit_rect buffer = {0, 0, sinit_scale_length(width, scale),
+                              sinit_scale_length(height, scale)};
+
+  pthread_mutex_lock(&scene->lock);
+
+  struct sinit_damage damage = scene->damage;
+  scene->damage.n_rects = 0;
+
+  bool full = !sinit_surface_buffer_valid(surf);
+  if (width != scene->width || height != scene->height ||
+      scale != scene->scale) {
+    scene->width = width;
+    scene->height = height;
+    scene->scale = scale;
+    scene->root->width = width;
+    scene->root->height = height;
+    node_mark_subtree(scene->root);
+    full = true;
+  }
+
+  node_layout(scene->root, 0, 0, scale);
+  node_collect(scene->root, true, scale, &damage);
+  if (full) {
+    damage.rects[0] = buffer;
+    damage.n_rects = 1;
+  }
+
+  // An empty damage makes sinit damage the whole unchanged buffer, this only
+  // happens on frames not requested by the scene.
+  for (int i = 0; i < damage.n_rects; i++) {
+    struct sinit_rect r = rect_intersect(damage.rects[i], buffer);
+    if (rect_empty(r))
+      continue;
+
+    sinit_draw_rect(buf, stride, r.x, r.y, r.width, r.height,
+                    scene->background);
+    node_paint(scene->root, buf, stride, r, scale);
+    sinit_surface_damage(surf, r.x, r.y, r.width, r.height);
+  }
+
+  pthread_mutex_unlock(&scene->lock);
+}
+
+/**
+ * Creates a group, an optionally clipping container of nodes with a
+ * background color (transparent by default), as last child of parent.
+ */
+struct sinit_node *sinit_node_group(struct sinit_node *parent,
+                                    enum sinit_layout layout) {
+  pthread_mutex_lock(&parent->scene->lock);
+
+  struct sinit_node *node = node_new(parent->scene, parent, NODE_GROUP);
+  node->layout = layout;
+  scene_changed(node->scene);
+
+  pthread_mutex_unlock(&parent->scene->lock);
+  return node;
+}
+
+/**
+ * Creates a rectangle filled with color as last child of parent. Rectangles
+ * have no intrinsic size.
+ */
+struct sinit_node *sinit_node_rect(struct sinit_node *parent, uint32_t color) {
+  pthread_mutex_lock(&parent->scene->lock);
+
+  struct sinit_node *node = node_new(parent->scene, parent, NODE_RECT);
+  node->color = color;
+  scene_changed(node->scene);
+
+  pthread_mutex_unlock(&parent->scene->lock);
+  return node;
+}
+
+/**
+ * Creates a single line of UTF-8 text as last child of parent. Font must
+ * outlive node.
+ */
+struct sinit_node *sinit_node_text(struct sinit_node *parent,
+                                   struct sinit_font *font, const char *text,
+                                   uint32_t color) {
+  pthread_mutex_lock(&parent->scene->lock);
+
+  struct sinit_node *node = node_new(parent->scene, parent, NODE_TEXT);
+  node->font = font;
+  node->text = strdup(text);
+  if (node->text == NULL)
+    LOG_FATAL("failed to allocate scene text");
+  node->color = color;
+  scene_changed(node->scene);
+
+  pthread_mutex_unlock(&parent->scene->lock);
+  return node;
+}
+
+static void node_copy_icon(struct sinit_node *node, const uint32_t *pixels,
+                           int width, int height) {
+  size_t size = (size_t)width * height * sizeof(*pixels);
+  free(node->pixels);
+  node->pixels = malloc(size);
+  if (node->pixels == NULL && size > 0)
+    LOG_FATAL("failed to allocate scene icon");
+  memcpy(node->pixels, pixels, size);
+  node->icon_width = width;
+  node->icon_height = height;
+}
+
+/**
+ * Creates an icon as last child of parent. pixels is a premultiplied ARGB8888
+ * image of width x height pixels, it is copied and composited unscaled in
+ * buffer pixels.
+ */
+struct sinit_node *sinit_node_icon(struct sinit_node *parent,
+                                   const uint32_t *pixels, int width,
+                                   int height) {
+  pthread_mutex_lock(&parent->scene->lock);
+
+  struct sinit_node *node = node_new(parent->scene, parent, NODE_ICON);
+  node_copy_icon(node, pixels, width, height);
+  scene_changed(node->scene);
+
+  pthread_mutex_unlock(&parent->scene->lock);
+  return node;
+}
+
+/**
+ * Destroys node and its children.
+ */
+void sinit_node_destroy(struct sinit_node *node) {
+  struct sinit_scene *scene = node->scene;
+  // Root is destroyed with scene.
+  if (node->parent == NULL)
+    return;
+
+  pthread_mutex_lock(&scene->lock);
+
+  node_unpaint(node);
+
+  struct sinit_node *parent = node->parent;
+  if (node->prev != NULL)
+    node->prev->next = node->next;
+  else
+    parent->first_child = node->next;
+  if (node->next != NULL)
+    node->next->prev = node->prev;
+  else
+    parent->last_child = node->prev;
+  node_mark_layout(parent);
+
+  node_free(node);
+
+  scene_changed(scene);
+  pthread_mutex_unlock(&scene->lock);
+}
+
+/**
+ * Sets position of node relative to its parent.
+ */
+void sinit_node_set_position(struct sinit_node *node, int x, int y) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (node->x != x || node->y != y) {
+    node->x = x;
+    node->y = y;
+    node_mark_layout(node);
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Sets size of node. A width or height of 0 uses intrinsic size of node.
+ */
+void sinit_node_set_size(struct sinit_node *node, int width, int height) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (node->width != width || node->height != height) {
+    node->width = width;
+    node->height = height;
+    node_mark_layout(node);
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Shows or hides node. Hidden nodes take no room in rows and columns.
+ */
+void sinit_node_set_visible(struct sinit_node *node, bool visible) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (node->visible != visible) {
+    node->visible = visible;
+    if (visible) {
+      node_mark_subtree(node);
+    } else {
+      node_unpaint(node);
+      node_mark_layout(node);
+    }
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Sets color of rectangle or text, or background of group.
+ */
+void sinit_node_set_color(struct sinit_node *node, uint32_t color) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (node->color != color) {
+    node->color = color;
+    node_mark_paint(node);
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Sets text of text node. Setting the current text is a no-op.
+ */
+void sinit_node_set_text(struct sinit_node *node, const char *text) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (strcmp(node->text, text) != 0) {
+    free(node->text);
+    node->text = strdup(text);
+    if (node->text == NULL)
+      LOG_FATAL("failed to allocate scene text");
+    node_mark_layout(node);
+    node_mark_paint(node);
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Sets image of icon node. See sinit_node_icon().
+ */
+void sinit_node_set_icon(struct sinit_node *node, const uint32_t *pixels,
+                         int width, int height) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  node_copy_icon(node, pixels, width, height);
+  node_mark_layout(node);
+  node_mark_paint(node);
+  scene_changed(node->scene);
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Sets whether children of group are clipped to its bounds. Disabled by
+ * default.
+ */
+void sinit_node_set_clip(struct sinit_node *node, bool clip) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (node->clip != clip) {
+    node->clip = clip;
+    // Children may be painted outside of group.
+    node_mark_subtree(node);
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
+
+/**
+ * Sets space between children of row or column group and between children
+ * and group borders.
+ */
+void sinit_node_set_spacing(struct sinit_node *node, int spacing,
+                            int padding) {
+  pthread_mutex_lock(&node->scene->lock);
+
+  if (node->spacing != spacing || node->padding != padding) {
+    node->spacing = spacing;
+    node->padding = padding;
+    node_mark_layout(node);
+    scene_changed(node->scene);
+  }
+
+  pthread_mutex_unlock(&node->scene->lock);
+}
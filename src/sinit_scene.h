@@ -0,0 +1,164 @@
+#ifndef SINIT_SCENE_H_INCLUDE
+#define SINIT_SCENE_H_INCLUDE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sinit.h"
+#include "sinit_text.h"
+
+/**
+ * Retained scene on top of a sinit surface. Instead of drawing everything in
+ * its render function, an application builds a tree of nodes (groups,
+ * rectangles, text and icons) and updates their properties. The scene
+ * requests a frame when a node changes, relayouts only the changed subtrees
+ * and repaints and damages only the area of nodes that changed.
+ *
+ * Geometry is in surface-local coordinates. Colors are premultiplied
+ * ARGB8888. Scenes only render to 32 bits xRGB buffers, the default format
+ * of surfaces.
+ *
+ * Scene and its nodes must be modified from the thread dispatching sinit
+ * events and never from a render function. They may be rendered on a worker
+ * thread.
+ */
+
+struct sinit_node;
+
+/**
+ * How a group places its children. Children of SINIT_LAYOUT_NONE groups are
+ * placed at their position relative to the group. Rows and columns stack
+ * visible children left to right or top to bottom and ignore their position.
+ */
+enum sinit_layout {
+  SINIT_LAYOUT_NONE,
+  SINIT_LAYOUT_ROW,
+  SINIT_LAYOUT_COLUMN,
+};
+
+/**
+ * A scene. Fields are private and must not be accessed directly.
+ */
+struct sinit_scene {
+  sinit_surface *surface;
+  struct sinit_node *root;
+  pthread_mutex_t lock;
+  uint32_t background;
+
+  // Geometry of last render.
+  int width;
+  int height;
+  double scale;
+
+  // Damage of nodes removed or hidden since last render, in buffer
+  // coordinates.
+  struct sinit_damage damage;
+};
+
+/**
+ * Initializes an empty scene rendered on surf, whose render function must be
+ * sinit_scene_render() with scene as userdata. Surface doesn't need to be
+ * initialized yet but must be before nodes are created. Areas not covered by
+ * any node are filled with background.
+ */
+void sinit_scene_init(struct sinit_scene *scene, sinit_surface *surf,
+                      uint32_t background);
+
+/**
+ * Destroys all nodes of scene.
+ */
+void sinit_scene_deinit(struct sinit_scene *scene);
+
+/**
+ * Returns root group of scene. It has the size of the surface and places its
+ * children with SINIT_LAYOUT_NONE by default.
+ */
+struct sinit_node *sinit_scene_root(struct sinit_scene *scene);
+
+/**
+ * Render function of surfaces displaying a scene, userdata is the scene.
+ */
+void sinit_scene_render(sinit_surface *surf, void *buf, int width, int height,
+                        int stride, enum sinit_format format, double scale,
+                        uint32_t time, void *userdata);
+
+/**
+ * Creates a group, an optionally clipping container of nodes with a
+ * background color (transparent by default), as last child of parent.
+ */
+struct sinit_node *sinit_node_group(struct sinit_node *parent,
+                                    enum sinit_layout layout);
+
+/**
+ * Creates a rectangle filled with color as last child of parent. Rectangles
+ * have no intrinsic size.
+ */
+struct sinit_node *sinit_node_rect(struct sinit_node *parent, uint32_t color);
+
+/**
+ * Creates a single line of UTF-8 text as last child of parent. Font must
+ * outlive node.
+ */
+struct sinit_node *sinit_node_text(struct sinit_node *parent,
+                                   struct sinit_font *font, const char *text,
+                                   uint32_t color);
+
+/**
+ * Creates an icon as last child of parent. pixels is a premultiplied ARGB8888
+ * image of width x height pixels, it is copied and composited unscaled in
+ * buffer pixels.
+ */
+struct sinit_node *sinit_node_icon(struct sinit_node *parent,
+                                   const uint32_t *pixels, int width,
+                                   int height);
+
+/**
+ * Destroys node and its children.
+ */
+void sinit_node_destroy(struct sinit_node *node);
+
+/**
+ * Sets position of node relative to its parent.
+ */
+void sinit_node_set_position(struct sinit_node *node, int x, int y);
+
+/**
+ * Sets size of node. A width or height of 0 uses intrinsic size of node.
+ */
+void sinit_node_set_size(struct sinit_node *node, int width, int height);
+
+/**
+ * Shows or hides node. Hidden nodes take no room in rows and columns.
+ */
+void sinit_node_set_visible(struct sinit_node *node, bool visible);
+
+/**
+ * Sets color of rectangle or text, or background of group.
+ */
+void sinit_node_set_color(struct sinit_node *node, uint32_t color);
+
+/**
+ * Sets text of text node. Setting the current text is a no-op.
+ */
+void sinit_node_set_text(struct sinit_node *node, const char *text);
+
+/**
+ * Sets image of icon node. See sinit_node_icon().
+ */
+void sinit_node_set_icon(struct sinit_node *node, const uint32_t *pixels,
+                         int width, int height);
+
+/**
+ * Sets whether children of group are clipped to its bounds. Disabled by
+ * default.
+ */
+void sinit_node_set_clip(struct sinit_node *node, bool clip);
+
+/**
+ * Sets space between children of row or column group and between children
+ * and group borders.
+ */
+void sinit_node_set_spacing(struct sinit_node *node, int spacing, int padding);
+
+#endif
@@ -0,0 +1,48 @@
+// Single header file integrating sinit in a sd-event loop.
+
+#ifndef SINIT_SD_EVENT_H_INCLUDE
+#define SINIT_SD_EVENT_H_INCLUDE
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <systemd/sd-event.h>
+
+#include "sinit.h"
+
+static int sinit_sd_event_prepare(sd_event_source *s, void *userdata) {
+  (void)s;
+  (void)userdata;
+  return sinit_prepare() < 0 ? -EPIPE : 0;
+}
+
+static int sinit_sd_event_io(sd_event_source *s, int fd, uint32_t revents,
+                             void *userdata) {
+  (void)s;
+  (void)fd;
+  (void)revents;
+  (void)userdata;
+  return sinit_dispatch_pending() < 0 ? -EPIPE : 0;
+}
+
+/**
+ * Attaches sinit to the given sd-event loop. sinit must be initialized. Events
+ * are read and dispatched from within the loop, sinit_run() must not be
+ * called. It returns a negative errno on error.
+ */
+static inline int sinit_attach_sd_event(sd_event *event,
+                                        sd_event_source **source) {
+  int r = sd_event_add_io(event, source, sinit_fd(), EPOLLIN,
+                          sinit_sd_event_io, NULL);
+  if (r < 0)
+    return r;
+
+  r = sd_event_source_set_prepare(*source, sinit_sd_event_prepare);
+  if (r < 0) {
+    *source = sd_event_source_unref(*source);
+    return r;
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,540 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "sinit_draw.h"
+#include "sinit_text.h"
+
+#ifndef LOG_MODULE
+#define LOG_MODULE "sinit_text"
+#endif
+#include "log.h"
+
+// Glyph atlas is ATLAS_WIDTH pixels wide and grows in height up to
+// ATLAS_MAX_HEIGHT. Once full, it is flushed along with all cached glyphs and
+// runs.
+#define ATLAS_WIDTH 1024
+#define ATLAS_MIN_HEIGHT 128
+#define ATLAS_MAX_HEIGHT 4096
+// Number of cached laid out strings.
+#define RUN_CACHE_LEN 256
+
+#define HASH_INIT 0xcbf29ce484222325ull
+
+struct sinit_font {
+  uint32_t id;
+  FT_Face face;
+  // Size in surface-local pixels.
+  int size;
+  // Pixel size face is currently set to, in 26.6 fixed point.
+  uint32_t face_size;
+};
+
+// A rasterized glyph. Slot is empty if font is 0.
+struct glyph {
+  uint32_t font;
+  uint32_t size;
+  uint32_t codepoint;
+  FT_UInt index;
+  // Bitmap rectangle in atlas.
+  uint16_t x, y, width, height;
+  // Offset of bitmap from pen position, top is upward.
+  int16_t left, top;
+  // Advance in 26.6 fixed point.
+  int32_t advance;
+};
+
+struct run_glyph {
+  // Offset of bitmap top-left corner from text origin.
+  int16_t x, y;
+  uint16_t atlas_x, atlas_y, width, height;
+};
+
+// A laid out string. Slot is empty if text is NULL.
+struct run {
+  uint64_t hash;
+  uint32_t font;
+  uint32_t size;
+  char *text;
+  int width;
+  int n_glyphs;
+  struct run_glyph *glyphs;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  FT_Library library;
+  int n_fonts;
+  uint32_t next_font;
+
+  uint8_t *atlas;
+  int atlas_height;
+  // Current shelf of atlas packer.
+  int shelf_x, shelf_y, shelf_height;
+  // Incremented whenever atlas is flushed.
+  uint64_t generation;
+
+  // Open addressing hash table of glyphs.
+  struct glyph *glyphs;
+  size_t glyphs_cap;
+  size_t n_glyphs;
+
+  // Direct mapped cache of runs.
+  struct run runs[RUN_CACHE_LEN];
+
+  // Number of draws compositing without holding lock. Atlas and runs they
+  // read are only modified once it drops to 0.
+  int readers;
+  pthread_cond_t readers_done;
+} text = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .readers_done = PTHREAD_COND_INITIALIZER,
+};
+
+// FNV-1a.
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+  const uint8_t *p = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Decodes next UTF-8 codepoint of s and advances it. Invalid sequences are
+// decoded as U+FFFD.
+static uint32_t utf8_next(const char **s) {
+  const uint8_t *p = (const uint8_t *)*s;
+  uint32_t cp;
+  int n;
+
+  if (p[0] < 0x80) {
+    cp = p[0];
+    n = 0;
+  } else if ((p[0] & 0xe0) == 0xc0) {
+    cp = p[0] & 0x1f;
+    n = 1;
+  } else if ((p[0] & 0xf0) == 0xe0) {
+    cp = p[0] & 0x0f;
+    n = 2;
+  } else if ((p[0] & 0xf8) == 0xf0) {
+    cp = p[0] & 0x07;
+    n = 3;
+  } else {
+    *s += 1;
+    return 0xfffd;
+  }
+
+  for (int i = 1; i <= n; i++) {
+    if ((p[i] & 0xc0) != 0x80) {
+      *s += i;
+      return 0xfffd;
+    }
+    cp = cp << 6 | (p[i] & 0x3f);
+  }
+
+  *s += n + 1;
+  return cp;
+}
+
+static struct glyph *glyph_slot(uint32_t font, uint32_t size, uint32_t cp) {
+  uint32_t key[3] = {font, size, cp};
+  size_t mask = text.glyphs_cap - 1;
+
+  for (size_t i = hash_bytes(HASH_INIT, key, sizeof(key)) & mask;;
+       i = (i + 1) & mask) {
+    struct glyph *g = &text.glyphs[i];
+    if (g->font == 0 ||
+        (g->font == font && g->size == size && g->codepoint == cp))
+      return g;
+  }
+}
+
+static void glyphs_grow(void) {
+  struct glyph *old = text.glyphs;
+  size_t old_cap = text.glyphs_cap;
+
+  text.glyphs_cap = old_cap > 0 ? old_cap * 2 : 256;
+  text.glyphs = calloc(text.glyphs_cap, sizeof(*text.glyphs));
+  if (text.glyphs == NULL)
+    LOG_FATAL("failed to allocate glyph cache");
+
+  for (size_t i = 0; i < old_cap; i++)
+    if (old[i].font != 0)
+      *glyph_slot(old[i].font, old[i].size, old[i].codepoint) = old[i];
+  free(old);
+}
+
+static void run_clear(struct run *r) {
+  free(r->text);
+  free(r->glyphs);
+  *r = (struct run){0};
+}
+
+// Drops all glyphs and runs.
+static void atlas_flush(void) {
+  LOG_DBG("glyph atlas is full, flushing it");
+
+  memset(text.atlas, 0, (size_t)ATLAS_WIDTH * text.atlas_height);
+  memset(text.glyphs, 0, text.glyphs_cap * sizeof(*text.glyphs));
+  text.n_glyphs = 0;
+  for (int i = 0; i < RUN_CACHE_LEN; i++)
+    run_clear(&text.runs[i]);
+
+  text.shelf_x = 0;
+  text.shelf_y = 0;
+  text.shelf_height = 0;
+  text.generation++;
+}
+
+// Reserves a width x height rectangle in atlas using a shelf packer. Atlas is
+// grown or flushed if there is no room left. It returns false if glyph can't
+// fit in atlas.
+static bool atlas_alloc(int width, int height, int *x, int *y) {
+  if (width > ATLAS_WIDTH || height > ATLAS_MAX_HEIGHT)
+    return false;
+
+  if (text.shelf_x + width > ATLAS_WIDTH) {
+    text.shelf_y += text.shelf_height;
+    text.shelf_x = 0;
+    text.shelf_height = 0;
+  }
+
+  if (text.shelf_y + height > text.atlas_height) {
+    int h = text.atlas_height;
+    while (h < text.shelf_y + height && h < ATLAS_MAX_HEIGHT)
+      h *= 2;
+
+    if (text.shelf_y + height > h) {
+      atlas_flush();
+      return atlas_alloc(width, height, x, y);
+    }
+
+    uint8_t *atlas = realloc(text.atlas, (size_t)ATLAS_WIDTH * h);
+    if (atlas == NULL)
+      LOG_FATAL("failed to grow glyph atlas");
+    memset(atlas + (size_t)ATLAS_WIDTH * text.atlas_height, 0,
+           (size_t)ATLAS_WIDTH * (h - text.atlas_height));
+    text.atlas = atlas;
+    text.atlas_height = h;
+  }
+
+  *x = text.shelf_x;
+  *y = text.shelf_y;
+  text.shelf_x += width;
+  if (height > text.shelf_height)
+    text.shelf_height = height;
+  return true;
+}
+
+// Copies a FreeType bitmap to atlas at x, y.
+static void atlas_blit(FT_Bitmap *bm, int x, int y) {
+  for (unsigned row = 0; row < bm->rows; row++) {
+    uint8_t *dst = text.atlas + (size_t)(y + row) * ATLAS_WIDTH + x;
+    const uint8_t *src = bm->buffer + (ptrdiff_t)row * bm->pitch;
+
+    if (bm->pixel_mode == FT_PIXEL_MODE_GRAY) {
+      memcpy(dst, src, bm->width);
+    } else {
+      for (unsigned col = 0; col < bm->width; col++)
+        dst[col] = (src[col / 8] >> (7 - col % 8)) & 1 ? 0xff : 0;
+    }
+  }
+}
+
+static bool font_set_size(struct sinit_font *font, uint32_t size) {
+  if (font->face_size == size)
+    return true;
+
+  // Character size in points at 72 DPI is the pixel size.
+  FT_Error err = FT_Set_Char_Size(font->face, 0, size, 0, 0);
+  if (err != 0) {
+    LOG_DBG("failed to set font size to %u/64px: error %d", size, err);
+    return false;
+  }
+
+  font->face_size = size;
+  return true;
+}
+
+// Returns pixel size in 26.6 fixed point of font at the given scale.
+static uint32_t font_pixel_size(struct sinit_font *font, double scale) {
+  return font->size * scale * 64 + 0.5;
+}
+
+// Returns cached glyph, rasterizing it if needed. This may flush atlas.
+static struct glyph *glyph_get(struct sinit_font *font, uint32_t size,
+                               uint32_t cp) {
+  if ((text.n_glyphs + 1) * 2 > text.glyphs_cap)
+    glyphs_grow();
+
+  struct glyph *g = glyph_slot(font->id, size, cp);
+  if (g->font != 0)
+    return g;
+
+  struct glyph glyph = {.font = font->id, .size = size, .codepoint = cp};
+  FT_Face face = font->face;
+  glyph.index = FT_Get_Char_Index(face, cp);
+
+  if (font_set_size(font, size) &&
+      FT_Load_Glyph(face, glyph.index, FT_LOAD_TARGET_LIGHT) == 0 &&
+      FT_Render_Glyph(face->glyph, FT_RENDER_MODE_LIGHT) == 0) {
+    FT_GlyphSlot slot = face->glyph;
+    FT_Bitmap *bm = &slot->bitmap;
+    int x, y;
+
+    glyph.advance = slot->advance.x;
+    glyph.left = slot->bitmap_left;
+    glyph.top = slot->bitmap_top;
+
+    if ((bm->pixel_mode == FT_PIXEL_MODE_GRAY ||
+         bm->pixel_mode == FT_PIXEL_MODE_MONO) &&
+        bm->width > 0 && bm->rows > 0 &&
+        atlas_alloc(bm->width, bm->rows, &x, &y)) {
+      atlas_blit(bm, x, y);
+      glyph.x = x;
+      glyph.y = y;
+      glyph.width = bm->width;
+      glyph.height = bm->rows;
+    }
+  } else {
+    LOG_DBG("failed to render glyph U+%04X", cp);
+  }
+
+  // Atlas may have been flushed along with glyphs.
+  g = glyph_slot(font->id, size, cp);
+  *g = glyph;
+  text.n_glyphs++;
+  return g;
+}
+
+// Lays out str in run. It returns false if atlas was flushed meanwhile, in
+// which case glyphs laid out before the flush are invalid.
+static bool run_layout(struct run *r, struct sinit_font *font, uint32_t size,
+                       const char *str) {
+  uint64_t generation = text.generation;
+  FT_Face face = font->face;
+  bool kerning = FT_HAS_KERNING(face);
+  FT_UInt prev = 0;
+  FT_Pos pen = 0;
+
+  r->n_glyphs = 0;
+  r->glyphs = malloc((strlen(str) + 1) * sizeof(*r->glyphs));
+  if (r->glyphs == NULL)
+    LOG_FATAL("failed to allocate text run");
+
+  while (*str != '\0') {
+    struct glyph *g = glyph_get(font, size, utf8_next(&str));
+
+    FT_Vector delta;
+    if (kerning && prev != 0 && g->index != 0 && font_set_size(font, size) &&
+        FT_Get_Kerning(face, prev, g->index, FT_KERNING_DEFAULT, &delta) == 0)
+      pen += delta.x;
+    prev = g->index;
+
+    if (g->width > 0) {
+      struct run_glyph *rg = &r->glyphs[r->n_glyphs++];
+      rg->x = ((pen + 32) >> 6) + g->left;
+      rg->y = -g->top;
+      rg->atlas_x = g->x;
+      rg->atlas_y = g->y;
+      rg->width = g->width;
+      rg->height = g->height;
+    }
+
+    pen += g->advance;
+  }
+
+  r->width = (pen + 63) >> 6;
+  return text.generation == generation;
+}
+
+static bool run_match(struct run *r, uint64_t hash, struct sinit_font *font,
+                      uint32_t size, const char *str) {
+  return r->text != NULL && r->hash == hash && r->font == font->id &&
+         r->size == size && strcmp(r->text, str) == 0;
+}
+
+// Returns cached run of str, laying it out if needed.
+static struct run *run_get(struct sinit_font *font, uint32_t size,
+                           const char *str) {
+  uint64_t hash = hash_bytes(HASH_INIT ^ font->id ^ (uint64_t)size << 32, str,
+                             strlen(str));
+  struct run *r = &text.runs[hash % RUN_CACHE_LEN];
+
+  if (run_match(r, hash, font, size, str))
+    return r;
+
+  // Layout may grow or flush atlas and evicts a run, wait for draws reading
+  // them. Lock isn't released past this point so none can start meanwhile.
+  while (text.readers > 0)
+    pthread_cond_wait(&text.readers_done, &text.lock);
+
+  // Another thread may have laid out str while we were waiting.
+  if (run_match(r, hash, font, size, str))
+    return r;
+
+  struct run run = {.hash = hash, .font = font->id, .size = size};
+  if (!run_layout(&run, font, size, str)) {
+    // A string can't flush atlas twice unless it doesn't fit in it.
+    free(run.glyphs);
+    run_layout(&run, font, size, str);
+  }
+
+  run.text = strdup(str);
+  if (run.text == NULL)
+    LOG_FATAL("failed to allocate text run");
+
+  run_clear(r);
+  *r = run;
+  return r;
+}
+
+static void text_init(void) {
+  FT_Error err = FT_Init_FreeType(&text.library);
+  if (err != 0)
+    LOG_FATAL("failed to initialize FreeType: error %d", err);
+
+  text.atlas_height = ATLAS_MIN_HEIGHT;
+  text.atlas = calloc((size_t)ATLAS_WIDTH * text.atlas_height, 1);
+  if (text.atlas == NULL)
+    LOG_FATAL("failed to allocate glyph atlas");
+  glyphs_grow();
+}
+
+static void text_deinit(void) {
+  for (int i = 0; i < RUN_CACHE_LEN; i++)
+    run_clear(&text.runs[i]);
+  free(text.glyphs);
+  text.glyphs = NULL;
+  text.glyphs_cap = 0;
+  text.n_glyphs = 0;
+  free(text.atlas);
+  text.atlas = NULL;
+  text.shelf_x = 0;
+  text.shelf_y = 0;
+  text.shelf_height = 0;
+
+  FT_Done_FreeType(text.library);
+  text.library = NULL;
+}
+
+/**
+ * Opens font file at path. size is in surface-local pixels, it is multiplied
+ * by scale of draws. NULL is returned on error.
+ */
+struct sinit_font *sinit_font_open(const char *path, int size) {
+  struct sinit_font *font = calloc(1, sizeof(*font));
+  if (font == NULL) {
+    LOG_ERR("failed to allocate font");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&text.lock);
+
+  if (text.n_fonts++ == 0)
+    text_init();
+
+  FT_Error err = FT_New_Face(text.library, path, 0, &font->face);
+  if (err != 0) {
+    LOG_ERR("failed to open font %s: error %d", path, err);
+    if (--text.n_fonts == 0)
+      text_deinit();
+    pthread_mutex_unlock(&text.lock);
+    free(font);
+    return NULL;
+  }
+
+  font->id = ++text.next_font;
+  font->size = size;
+
+  pthread_mutex_unlock(&text.lock);
+
+  return font;
+}
+
+/**
+ * Closes font. Cache is freed once all fonts are closed.
+ */
+void sinit_font_close(struct sinit_font *font) {
+  pthread_mutex_lock(&text.lock);
+
+  // Glyphs and runs of font are never looked up again and are evicted on
+  // next flush.
+  FT_Done_Face(font->face);
+  free(font);
+
+  if (--text.n_fonts == 0)
+    text_deinit();
+
+  pthread_mutex_unlock(&text.lock);
+}
+
+/**
+ * Computes extents of UTF-8 text rendered at the given scale.
+ */
+void sinit_text_extents(struct sinit_font *font, double scale,
+                        const char *str, struct sinit_text_extents *extents) {
+  pthread_mutex_lock(&text.lock);
+
+  uint32_t size = font_pixel_size(font, scale);
+  extents->width = run_get(font, size, str)->width;
+  extents->ascent = 0;
+  extents->descent = 0;
+  if (font_set_size(font, size)) {
+    FT_Size_Metrics *m = &font->face->size->metrics;
+    extents->ascent = (m->ascender + 63) >> 6;
+    extents->descent = (-m->descender + 63) >> 6;
+  }
+
+  pthread_mutex_unlock(&text.lock);
+}
+
+/**
+ * Draws UTF-8 text in premultiplied color on an ARGB8888 buffer of width x
+ * height pixels, such as the one passed to sinit_render_fn. x and y are the
+ * buffer coordinates of the start of the baseline. Text is clipped to buffer.
+ */
+void sinit_text_draw(void *buf, int stride, int width, int height,
+                     struct sinit_font *font, double scale, int x, int y,
+                     const char *str, uint32_t color) {
+  // Lock is only held to look up run, compositing pins atlas and run instead
+  // so draws run in parallel.
+  pthread_mutex_lock(&text.lock);
+  struct run *r = run_get(font, font_pixel_size(font, scale), str);
+  const uint8_t *atlas = text.atlas;
+  text.readers++;
+  pthread_mutex_unlock(&text.lock);
+
+  for (int i = 0; i < r->n_glyphs; i++) {
+    struct run_glyph *rg = &r->glyphs[i];
+    int gx = x + rg->x;
+    int gy = y + rg->y;
+
+    // Clip glyph to buffer.
+    int x0 = gx < 0 ? -gx : 0;
+    int y0 = gy < 0 ? -gy : 0;
+    int x1 = gx + rg->width > width ? width - gx : rg->width;
+    int y1 = gy + rg->height > height ? height - gy : rg->height;
+    if (x1 <= x0)
+      continue;
+
+    for (int row = y0; row < y1; row++) {
+      sinit_draw_mask((uint32_t *)((char *)buf + (size_t)(gy + row) * stride) +
+                          gx + x0,
+                      atlas + (size_t)(rg->atlas_y + row) * ATLAS_WIDTH +
+                          rg->atlas_x + x0,
+                      x1 - x0, color);
+    }
+  }
+
+  pthread_mutex_lock(&text.lock);
+  if (--text.readers == 0)
+    pthread_cond_broadcast(&text.readers_done);
+  pthread_mutex_unlock(&text.lock);
+}
@@ -0,0 +1,57 @@
+#ifndef SINIT_TEXT_H_INCLUDE
+#define SINIT_TEXT_H_INCLUDE
+
+#include <stdint.h>
+
+/**
+ * Text rendering for sinit surfaces. Glyphs are rasterized once with FreeType
+ * into an A8 atlas shared by all fonts, keyed by font, pixel size and
+ * codepoint, and composited with sinit_draw_mask(). Laid out strings are
+ * cached too so repainting labels such as "85%" doesn't touch FreeType.
+ *
+ * Text is laid out left to right with font kerning, complex shaping is not
+ * supported. Functions are thread safe, draws of cached strings composite in
+ * parallel.
+ *
+ * Link with `pkg-config --libs freetype2`.
+ */
+
+struct sinit_font;
+
+/**
+ * Extents of a text in buffer pixels. ascent and descent are distances from
+ * the baseline and are positive.
+ */
+struct sinit_text_extents {
+  int width;
+  int ascent;
+  int descent;
+};
+
+/**
+ * Opens font file at path. size is in surface-local pixels, it is multiplied
+ * by scale of draws. NULL is returned on error.
+ */
+struct sinit_font *sinit_font_open(const char *path, int size);
+
+/**
+ * Closes font. Cache is freed once all fonts are closed.
+ */
+void sinit_font_close(struct sinit_font *font);
+
+/**
+ * Computes extents of UTF-8 text rendered at the given scale.
+ */
+void sinit_text_extents(struct sinit_font *font, double scale,
+                        const char *text, struct sinit_text_extents *extents);
+
+/**
+ * Draws UTF-8 text in premultiplied color on an ARGB8888 buffer of width x
+ * height pixels, such as the one passed to sinit_render_fn. x and y are the
+ * buffer coordinates of the start of the baseline. Text is clipped to buffer.
+ */
+void sinit_text_draw(void *buf, int stride, int width, int height,
+                     struct sinit_font *font, double scale, int x, int y,
+                     const char *text, uint32_t color);
+
+#endif